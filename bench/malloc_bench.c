@@ -0,0 +1,681 @@
+// 宿主机上的内核堆分配器基准测试（make bench）
+//
+// 以 -DMALLOC_HOSTED 把 src/kernel/memory/malloc.c 编译为宿主机代码，在一块 MAP_32BIT 的
+// mmap 区域上初始化内核堆，用可复现的负载测量吞吐、延迟分位数、峰值占用和碎片率。
+// 关中断由一把全局锁模拟（见 include/kernel/sync.h），每个线程对应一个分配上下文，
+// 与内核中单处理器、按进程切换上下文的模型一致。
+//
+// 64位宿主机上块头为24字节（内核中为16字节），结果只用于比较分配器改动前后的差异。
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+// 与 include/kernel/memory/malloc.h 对应的声明。内核头文件把 size_t 定义为 uint32_t，
+// 与宿主机的定义冲突，因此这里不能直接包含
+typedef struct HeapStats {
+    uint32_t chunk_count;
+    uint32_t free_count;
+    uint32_t free_bytes;
+    uint32_t largest_free;
+    uint32_t fragmentation;
+} HeapStats;
+
+extern void on_init_memory_manager(void* manager, uint32_t start, uint32_t size);
+extern void* kernel_malloc(uint32_t size);
+extern void kernel_free(void* ptr);
+extern void* kmalloc_aligned(uint32_t size, uint32_t align);
+extern void* kmalloc_pages(uint32_t count);
+extern void kfree_pages(void* pages, uint32_t count);
+extern void malloc_switch_context(uint32_t context);
+extern void malloc_release_context(uint32_t context);
+extern void malloc_get_heap_stats(HeapStats* stats);
+
+#define KERNEL_CONTEXT 0
+#define MAX_THREADS 32
+#define SAMPLE_INTERVAL 1024            // 每隔多少次操作采样一次堆占用
+#define DEFAULT_TRACE "bench/traces/boot.trace"
+
+// ---------------------------------------------------------------------------
+// 内核环境的宿主机替身
+
+static int verbose = 0;
+
+void kernel_printf(const char* format, ...) {
+    if (!verbose) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+// 基准测试中没有页面框管理器，整页分配全部落到堆上
+uint32_t pfm_get_free_frames_count() {
+    return 0;
+}
+
+uint32_t pfm_allocate_frames(uint32_t order) {
+    return 0;
+}
+
+void pfm_free_frames(uint32_t frame_address, uint32_t order) {
+}
+
+uint32_t pfm_order_for_count(uint32_t count) {
+    uint32_t order = 0;
+    while ((1U << order) < count) {
+        order++;
+    }
+    return order;
+}
+
+static volatile uint32_t cpu_lock = 0;
+static __thread uint32_t irq_depth = 0;
+
+uint32_t hosted_irq_save() {
+    if (irq_depth++ == 0) {
+        uint32_t spins = 0;
+        while (__sync_lock_test_and_set(&cpu_lock, 1)) {
+            if (++spins % 64 == 0) {
+                sched_yield();
+            }
+        }
+    }
+    return 0;
+}
+
+void hosted_irq_restore(uint32_t flags) {
+    if (--irq_depth == 0) {
+        __sync_lock_release(&cpu_lock);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// 堆与计时
+
+static uint64_t manager_storage[16 * 1024];     // MemoryManager，64位下比内核中大
+static char* arena = NULL;
+static uint32_t arena_size = 0;
+static uint32_t heap_size = 0;
+
+static void heap_reset() {
+    memset(manager_storage, 0, sizeof(manager_storage));
+    on_init_memory_manager(manager_storage, (uint32_t)(uintptr_t)arena, arena_size);
+    HeapStats stats;
+    malloc_get_heap_stats(&stats);
+    heap_size = stats.free_bytes;
+}
+
+static inline uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 以某个上下文的身份执行一次分配或释放，相当于在该进程中调用malloc
+static void* ctx_alloc(uint32_t ctx, uint32_t size) {
+    uint32_t flags = hosted_irq_save();
+    malloc_switch_context(ctx);
+    void* ptr = kernel_malloc(size);
+    hosted_irq_restore(flags);
+    return ptr;
+}
+
+static void ctx_free(uint32_t ctx, void* ptr) {
+    uint32_t flags = hosted_irq_save();
+    malloc_switch_context(ctx);
+    kernel_free(ptr);
+    hosted_irq_restore(flags);
+}
+
+// 一次运行的测量结果
+typedef struct Result {
+    uint64_t ops;
+    uint64_t elapsed_ns;            // 不计时的一遍的墙钟时间
+    uint32_t* latencies;            // 计时的一遍中每次操作的耗时
+    uint64_t latency_count;
+    uint64_t latency_capacity;
+    uint32_t peak_bytes;            // 堆占用峰值（堆大小减去大块空闲量）
+    uint32_t fragmentation;         // 结束时（释放剩余分配前）的碎片率
+    uint32_t failures;
+} Result;
+
+static void result_add_latency(Result* result, uint64_t ns) {
+    if (result->latency_count == result->latency_capacity) {
+        result->latency_capacity = result->latency_capacity ? result->latency_capacity * 2 : 1 << 16;
+        result->latencies = realloc(result->latencies, result->latency_capacity * sizeof(uint32_t));
+    }
+    result->latencies[result->latency_count++] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+}
+
+static void sample_footprint(Result* result, HeapStats* stats) {
+    malloc_get_heap_stats(stats);
+    uint32_t used = heap_size - stats->free_bytes;
+    if (used > result->peak_bytes) {
+        result->peak_bytes = used;
+    }
+}
+
+static int compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void result_print(const char* name, Result* result) {
+    uint32_t p50 = 0, p99 = 0, max = 0;
+    if (result->latency_count > 0) {
+        qsort(result->latencies, result->latency_count, sizeof(uint32_t), compare_u32);
+        p50 = result->latencies[result->latency_count / 2];
+        p99 = result->latencies[result->latency_count * 99 / 100];
+        max = result->latencies[result->latency_count - 1];
+    }
+    double mops = result->elapsed_ns ? (double)result->ops * 1000.0 / result->elapsed_ns : 0.0;
+
+    printf("%-18s %10llu %9.2f %8u %8u %9u %9u %7u%%",
+           name, (unsigned long long)result->ops, mops, p50, p99, max,
+           result->peak_bytes / 1024, result->fragmentation);
+    if (result->failures) {
+        printf("  (%u failed allocations)", result->failures);
+    }
+    printf("\n");
+    free(result->latencies);
+}
+
+// ---------------------------------------------------------------------------
+// 单线程负载：先生成操作序列，再在全新的堆上重放
+
+typedef enum OpKind {
+    OP_ALLOC,           // a <slot> <size>
+    OP_ALIGNED,         // A <slot> <size> <align>
+    OP_PAGES,           // p <slot> <pages>
+    OP_FREE,            // f <slot>
+    OP_SWITCH,          // c <ctx>
+    OP_RELEASE          // r <ctx>
+} OpKind;
+
+typedef struct TraceOp {
+    uint8_t kind;
+    uint32_t slot;
+    uint32_t arg;
+    uint32_t arg2;
+} TraceOp;
+
+typedef struct Trace {
+    TraceOp* ops;
+    uint64_t count;
+    uint64_t capacity;
+    uint32_t slots;
+} Trace;
+
+typedef struct Slot {
+    void* ptr;
+    uint8_t kind;
+    uint32_t pages;
+} Slot;
+
+static void trace_push(Trace* trace, uint8_t kind, uint32_t slot, uint32_t arg, uint32_t arg2) {
+    if (trace->count == trace->capacity) {
+        trace->capacity = trace->capacity ? trace->capacity * 2 : 4096;
+        trace->ops = realloc(trace->ops, trace->capacity * sizeof(TraceOp));
+    }
+    TraceOp* op = &trace->ops[trace->count++];
+    op->kind = kind;
+    op->slot = slot;
+    op->arg = arg;
+    op->arg2 = arg2;
+    if ((kind == OP_ALLOC || kind == OP_ALIGNED || kind == OP_PAGES || kind == OP_FREE) && slot >= trace->slots) {
+        trace->slots = slot + 1;
+    }
+}
+
+// 可复现的伪随机数（xorshift32）
+static inline uint32_t next_random(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// 随机选择槽位，空槽分配、占用的槽释放，live_slots决定稳态的存活分配数
+static void generate_slots(Trace* trace, uint32_t seed, uint64_t ops, uint32_t live_slots,
+                           uint32_t (*size_of)(uint32_t*)) {
+    uint8_t* used = calloc(live_slots, 1);
+    uint32_t state = seed ? seed : 1;
+    for (uint64_t i = 0; i < ops; i++) {
+        uint32_t slot = next_random(&state) % live_slots;
+        if (used[slot]) {
+            trace_push(trace, OP_FREE, slot, 0, 0);
+        } else {
+            trace_push(trace, OP_ALLOC, slot, size_of(&state), 0);
+        }
+        used[slot] = !used[slot];
+    }
+    free(used);
+}
+
+static uint32_t uniform_small_size(uint32_t* state) {
+    return 16 + next_random(state) % 497;               // 16..512
+}
+
+static uint32_t bimodal_size(uint32_t* state) {
+    if (next_random(state) % 10 != 0) {
+        return 16 + next_random(state) % 113;           // 16..128
+    }
+    return 4096 + next_random(state) % (60 * 1024 + 1); // 4K..64K
+}
+
+static int trace_load(Trace* trace, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+
+    char line[256];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_no++;
+        char kind;
+        unsigned a = 0, b = 0, c = 0;
+        int fields = sscanf(line, " %c %u %u %u", &kind, &a, &b, &c);
+        if (fields <= 0 || kind == '#') {
+            continue;
+        }
+
+        int ok = 1;
+        switch (kind) {
+            case 'a': ok = fields == 3; trace_push(trace, OP_ALLOC, a, b, 0); break;
+            case 'A': ok = fields == 4; trace_push(trace, OP_ALIGNED, a, b, c); break;
+            case 'p': ok = fields == 3; trace_push(trace, OP_PAGES, a, b, 0); break;
+            case 'f': ok = fields == 2; trace_push(trace, OP_FREE, a, 0, 0); break;
+            case 'c': ok = fields == 2; trace_push(trace, OP_SWITCH, 0, a, 0); break;
+            case 'r': ok = fields == 2; trace_push(trace, OP_RELEASE, 0, a, 0); break;
+            default: ok = 0; break;
+        }
+        if (!ok) {
+            fprintf(stderr, "%s:%d: malformed trace line\n", path, line_no);
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+static void slot_release(uint32_t ctx, Slot* slot) {
+    if (slot->ptr == NULL) {
+        return;
+    }
+    if (slot->kind == OP_PAGES) {
+        uint32_t flags = hosted_irq_save();
+        malloc_switch_context(ctx);
+        kfree_pages(slot->ptr, slot->pages);
+        hosted_irq_restore(flags);
+    } else {
+        ctx_free(ctx, slot->ptr);
+    }
+    slot->ptr = NULL;
+}
+
+// 重放一遍操作序列；measure非零时记录每次操作的耗时并定期采样堆占用
+static void trace_replay(Trace* trace, Result* result, int measure) {
+    Slot* slots = calloc(trace->slots ? trace->slots : 1, sizeof(Slot));
+    uint32_t ctx = KERNEL_CONTEXT;
+    HeapStats stats;
+
+    heap_reset();
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < trace->count; i++) {
+        TraceOp* op = &trace->ops[i];
+        Slot* slot = &slots[op->slot];
+        uint64_t t0 = measure ? now_ns() : 0;
+
+        switch (op->kind) {
+            case OP_ALLOC:
+            case OP_ALIGNED:
+            case OP_PAGES: {
+                slot_release(ctx, slot);    // 序列中不应出现，防御性处理
+                uint32_t flags = hosted_irq_save();
+                malloc_switch_context(ctx);
+                if (op->kind == OP_ALLOC) {
+                    slot->ptr = kernel_malloc(op->arg);
+                } else if (op->kind == OP_ALIGNED) {
+                    slot->ptr = kmalloc_aligned(op->arg, op->arg2);
+                } else {
+                    slot->ptr = kmalloc_pages(op->arg);
+                }
+                hosted_irq_restore(flags);
+                slot->kind = op->kind;
+                slot->pages = op->arg;
+                if (slot->ptr == NULL) {
+                    result->failures++;
+                }
+                break;
+            }
+            case OP_FREE:
+                slot_release(ctx, slot);
+                break;
+            case OP_SWITCH:
+                ctx = op->arg;
+                break;
+            case OP_RELEASE:
+                malloc_release_context(op->arg);
+                break;
+        }
+
+        if (measure) {
+            result_add_latency(result, now_ns() - t0);
+            if (i % SAMPLE_INTERVAL == 0) {
+                sample_footprint(result, &stats);
+            }
+        }
+    }
+    if (!measure) {
+        result->elapsed_ns += now_ns() - start;
+        result->ops += trace->count;
+    } else {
+        sample_footprint(result, &stats);
+        result->fragmentation = stats.fragmentation;
+    }
+
+    for (uint32_t i = 0; i < trace->slots; i++) {
+        slot_release(ctx, &slots[i]);
+    }
+    free(slots);
+}
+
+static void run_trace(const char* name, Trace* trace, uint32_t repeat) {
+    Result result;
+    memset(&result, 0, sizeof(result));
+    for (uint32_t i = 0; i < repeat; i++) {
+        trace_replay(trace, &result, 0);
+    }
+    trace_replay(trace, &result, 1);
+    result_print(name, &result);
+    free(trace->ops);
+}
+
+// ---------------------------------------------------------------------------
+// 多线程生产者/消费者：生产者分配，消费者在另一个上下文中释放
+
+#define QUEUE_CAPACITY 1024
+
+typedef struct Queue {
+    void* items[QUEUE_CAPACITY];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t count;
+    uint32_t producers_left;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} Queue;
+
+typedef struct Worker {
+    pthread_t thread;
+    uint32_t ctx;
+    uint32_t seed;
+    uint64_t ops;
+    Queue* queue;
+    Result result;      // 只使用其中的延迟数组
+    int measure;
+} Worker;
+
+static uint64_t producer_items = 200000;
+
+static void* producer_main(void* arg) {
+    Worker* worker = (Worker*)arg;
+    Queue* queue = worker->queue;
+    uint32_t state = worker->seed;
+
+    for (uint64_t i = 0; i < producer_items; i++) {
+        uint32_t size = 32 + next_random(&state) % 993;     // 32..1024
+        uint64_t t0 = worker->measure ? now_ns() : 0;
+        void* ptr = ctx_alloc(worker->ctx, size);
+        if (worker->measure) {
+            result_add_latency(&worker->result, now_ns() - t0);
+        }
+        if (ptr == NULL) {
+            worker->result.failures++;
+            continue;
+        }
+        memset(ptr, (int)i, size < 64 ? size : 64);
+        worker->ops++;
+
+        pthread_mutex_lock(&queue->mutex);
+        while (queue->count == QUEUE_CAPACITY) {
+            pthread_cond_wait(&queue->not_full, &queue->mutex);
+        }
+        queue->items[queue->tail] = ptr;
+        queue->tail = (queue->tail + 1) % QUEUE_CAPACITY;
+        queue->count++;
+        pthread_cond_signal(&queue->not_empty);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+    queue->producers_left--;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+    return NULL;
+}
+
+static void* consumer_main(void* arg) {
+    Worker* worker = (Worker*)arg;
+    Queue* queue = worker->queue;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->mutex);
+        while (queue->count == 0 && queue->producers_left > 0) {
+            pthread_cond_wait(&queue->not_empty, &queue->mutex);
+        }
+        if (queue->count == 0) {
+            pthread_mutex_unlock(&queue->mutex);
+            break;
+        }
+        void* ptr = queue->items[queue->head];
+        queue->head = (queue->head + 1) % QUEUE_CAPACITY;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+        pthread_mutex_unlock(&queue->mutex);
+
+        uint64_t t0 = worker->measure ? now_ns() : 0;
+        ctx_free(worker->ctx, ptr);
+        if (worker->measure) {
+            result_add_latency(&worker->result, now_ns() - t0);
+        }
+        worker->ops++;
+    }
+    return NULL;
+}
+
+static void producer_consumer_pass(uint32_t producers, uint32_t consumers, uint32_t seed,
+                                   Result* result, int measure) {
+    static Worker workers[MAX_THREADS];
+    static Queue queue;
+    uint32_t total = producers + consumers;
+
+    heap_reset();
+    memset(&queue, 0, sizeof(queue));
+    pthread_mutex_init(&queue.mutex, NULL);
+    pthread_cond_init(&queue.not_empty, NULL);
+    pthread_cond_init(&queue.not_full, NULL);
+    queue.producers_left = producers;
+
+    memset(workers, 0, sizeof(workers));
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < total; i++) {
+        workers[i].ctx = i + 1;                 // 每个线程一个进程上下文
+        workers[i].seed = seed * 2654435761U + i + 1;
+        workers[i].queue = &queue;
+        workers[i].measure = measure;
+        pthread_create(&workers[i].thread, NULL, i < producers ? producer_main : consumer_main, &workers[i]);
+    }
+
+    // 主线程在测量的一遍中定期采样堆占用
+    HeapStats stats;
+    if (measure) {
+        for (;;) {
+            pthread_mutex_lock(&queue.mutex);
+            uint32_t left = queue.producers_left + queue.count;
+            pthread_mutex_unlock(&queue.mutex);
+            if (left == 0) {
+                break;
+            }
+            sample_footprint(result, &stats);
+            struct timespec pause = {0, 1000000};
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    for (uint32_t i = 0; i < total; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    if (measure) {
+        sample_footprint(result, &stats);
+        result->fragmentation = stats.fragmentation;
+    } else {
+        result->elapsed_ns += elapsed;
+    }
+
+    for (uint32_t i = 0; i < total; i++) {
+        Worker* worker = &workers[i];
+        if (!measure) {
+            result->ops += worker->ops;
+        }
+        result->failures += worker->result.failures;
+        for (uint64_t j = 0; j < worker->result.latency_count; j++) {
+            result_add_latency(result, worker->result.latencies[j]);
+        }
+        free(worker->result.latencies);
+        malloc_release_context(worker->ctx);
+    }
+
+    pthread_mutex_destroy(&queue.mutex);
+    pthread_cond_destroy(&queue.not_empty);
+    pthread_cond_destroy(&queue.not_full);
+}
+
+static void run_producer_consumer(uint32_t producers, uint32_t consumers, uint32_t seed, uint32_t repeat) {
+    Result result;
+    memset(&result, 0, sizeof(result));
+    for (uint32_t i = 0; i < repeat; i++) {
+        producer_consumer_pass(producers, consumers, seed, &result, 0);
+    }
+    producer_consumer_pass(producers, consumers, seed, &result, 1);
+
+    char name[32];
+    snprintf(name, sizeof(name), "prod-cons %ux%u", producers, consumers);
+    result_print(name, &result);
+}
+
+// ---------------------------------------------------------------------------
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [-w workload] [-s seed] [-n ops] [-r repeat] [-t trace] [-a arena_mb]\n"
+            "          [-p producers] [-c consumers] [-v]\n"
+            "workloads: all (default), uniform, bimodal, boot, prodcons\n", program);
+}
+
+int main(int argc, char** argv) {
+    const char* workload = "all";
+    const char* trace_path = DEFAULT_TRACE;
+    uint32_t seed = 1;
+    uint64_t ops = 1000000;
+    uint32_t repeat = 3;
+    uint32_t arena_mb = 256;
+    uint32_t producers = 2;
+    uint32_t consumers = 2;
+
+    for (int i = 1; i < argc; i++) {
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+            continue;
+        }
+        if (value == NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (strcmp(argv[i], "-w") == 0) {
+            workload = value;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            seed = strtoul(value, NULL, 0);
+        } else if (strcmp(argv[i], "-n") == 0) {
+            ops = strtoull(value, NULL, 0);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            repeat = strtoul(value, NULL, 0);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            trace_path = value;
+        } else if (strcmp(argv[i], "-a") == 0) {
+            arena_mb = strtoul(value, NULL, 0);
+        } else if (strcmp(argv[i], "-p") == 0) {
+            producers = strtoul(value, NULL, 0);
+        } else if (strcmp(argv[i], "-c") == 0) {
+            consumers = strtoul(value, NULL, 0);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+    if (producers == 0 || consumers == 0 || producers + consumers > MAX_THREADS) {
+        fprintf(stderr, "producers and consumers must be >= 1 and total at most %d\n", MAX_THREADS);
+        return 1;
+    }
+
+    // 内核代码把指针当作32位整数处理，堆必须位于低4GB
+    arena_size = arena_mb * 1024 * 1024;
+    arena = mmap(NULL, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (arena == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    int all = strcmp(workload, "all") == 0;
+    printf("seed %u, arena %u MB, %u timed repeats + 1 measured pass\n", seed, arena_mb, repeat);
+    printf("%-18s %10s %9s %8s %8s %9s %9s %8s\n",
+           "workload", "ops", "Mops/s", "p50(ns)", "p99(ns)", "max(ns)", "peak(KB)", "frag");
+
+    if (all || strcmp(workload, "uniform") == 0) {
+        Trace trace;
+        memset(&trace, 0, sizeof(trace));
+        generate_slots(&trace, seed, ops, 4096, uniform_small_size);
+        run_trace("uniform-small", &trace, repeat);
+    }
+    if (all || strcmp(workload, "bimodal") == 0) {
+        Trace trace;
+        memset(&trace, 0, sizeof(trace));
+        generate_slots(&trace, seed, ops, 2048, bimodal_size);
+        run_trace("bimodal", &trace, repeat);
+    }
+    if (all || strcmp(workload, "boot") == 0) {
+        Trace trace;
+        memset(&trace, 0, sizeof(trace));
+        if (trace_load(&trace, trace_path) == 0) {
+            // 启动序列很短，多重放几遍以得到稳定的吞吐
+            run_trace("boot-replay", &trace, repeat * 20);
+        }
+    }
+    if (all || strcmp(workload, "prodcons") == 0) {
+        producer_items = ops / (2 * producers);
+        run_producer_consumer(producers, consumers, seed, repeat);
+    }
+
+    munmap(arena, arena_size);
+    return 0;
+}
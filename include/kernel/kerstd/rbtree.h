@@ -32,5 +32,10 @@ void rbtree_insert(RBTree* tree, RBTNode* node);
 void rbtree_delete(RBTree* tree, RBTNode* node);
 RBTNode* rbtree_minimum(RBTree* tree, RBTNode* node);
 RBTNode* rbtree_maximum(RBTree* tree, RBTNode* node);
+// 以下查询在不存在对应节点时返回NULL
+RBTNode* rbtree_first(RBTree* tree);
+RBTNode* rbtree_floor(RBTree* tree, uint32_t key);              // 键不大于key的最大节点
+RBTNode* rbtree_next(RBTree* tree, RBTNode* node);              // 中序后继
+RBTNode* rbtree_prev(RBTree* tree, RBTNode* node);              // 中序前驱
 
 #endif
\ No newline at end of file
@@ -2,45 +2,157 @@
 #define OS_KERNEL_MEMORY_MALLOC
 
 #include <stdtype.h>
+#include <kernel/multitask/process_limits.h>
 
 #define MIN_ALLOC_SIZE 16
-#define NUM_SIZE_CLASSES 7  // 增加大小类别数量
+#define NUM_SIZE_CLASSES 24  // 64字节以内按16字节递增，之后每个2的幂区间等分为4档
+#define SIZE_CLASS_MAX 2048  // 超过该大小的分配走大块分配器
 
 // 动态内存分配
 
 // 定义大小类别
 static const size_t size_classes[NUM_SIZE_CLASSES] = {
-    16, 32, 64, 128, 256, 512, 1024
+    16, 32, 48, 64,
+    80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024,
+    1280, 1536, 1792, 2048
 };
 
+// 大块分配器（TLSF）：一级按2的幂划分区间，二级把每个区间再等分为TLSF_SL_COUNT份，
+// 两级位图记录哪些空闲链表非空，分配和释放都只需常数次位运算
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_ALIGN_LOG2 4                                   // 与MIN_ALLOC_SIZE一致
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + TLSF_ALIGN_LOG2)
+#define TLSF_SMALL_BLOCK (1 << TLSF_FL_SHIFT)               // 小于该值的块线性映射到第0级
+#define TLSF_FL_COUNT (32 - TLSF_FL_SHIFT + 1)
+#define TLSF_MAX_ALLOC 0x80000000                           // 单次大块分配的上限
+
+// 大小类别每次从大块分配器取一页切分成小块；大的类别取若干页，保证每页至少能切出
+// SIZE_CLASS_MIN_CHUNKS个块
+#define SIZE_CLASS_PAGE_SIZE (4 * 1024)
+#define SIZE_CLASS_MIN_CHUNKS 8
+// 每个大小类别默认保留的完全空闲页数，超出的空闲页归还大块分配器
+#define SIZE_CLASS_PAGE_WATERMARK 2
+
+// 每个分配上下文的弹匣容量；弹匣空或满时与共享空闲链表成批交换MAGAZINE_BATCH个块
+#define MAGAZINE_SIZE 16
+#define MAGAZINE_BATCH (MAGAZINE_SIZE / 2)
+
+// 分配上下文数量：0号为内核上下文（无当前进程时使用），其余与PROCESS_MAX_COUNT个进程一一对应
+#define MALLOC_KERNEL_CONTEXT 0
+#define MALLOC_MAX_CONTEXTS (PROCESS_MAX_COUNT + 1)
+#define MALLOC_PROCESS_CONTEXT(pid) ((pid) + 1)
+#define MALLOC_NO_OWNER 0xFF        // 不经弹匣分配的小块，释放时直接归还所属页
+
+// 加固模式：make MALLOC_HARDEN=1 构建（需先make clean）。已分配块的块头带金丝雀，
+// 释放时校验块头并检测重复释放，发现问题只打印而不释放；
+// 小块回到所属页时用毒化值填充数据区开头，再次从页中取出时检查是否在释放后被写过；
+// 在弹匣中周转的块不毒化，快速路径的开销只有金丝雀的写入和校验
+#define MALLOC_POISON 0xDEADDEAD
+#define MALLOC_POISON_BYTES 8       // 只毒化开头的若干字节（不超过MIN_ALLOC_SIZE），使开销与块大小无关
+
 typedef enum Bool Bool;
 
+struct SizeClassPage;
+
 typedef struct MemoryChunk
 {
     struct MemoryChunk* next;
-    struct MemoryChunk* prev;
-    uint8_t allocated;          // 被分配是返回1,回收后返回0
+    union {
+        struct MemoryChunk* prev;       // 大块：空闲链表中的前驱
+        struct SizeClassPage* page;     // 小块：所属的大小类别页
+    };
     size_t size;
+    uint8_t allocated;          // 被分配是返回1,回收后返回0
+    uint8_t prev_free;          // 大块：物理上的前一个块空闲，其尾部存有指向其头部的脚标
     uint8_t size_class;         // 新增：记录大小类别索引，用于快速释放
-} MemoryChunk;
+    uint8_t owner;              // 小块：分配它的上下文，其他上下文释放时放入其远程释放链表
+} MemoryChunk;                  // 16字节，块大小均为16的倍数，数据区保持16字节对齐
+
+// 大小类别页描述符，位于页（一个已分配大块）数据区的起始处，其后是切分好的小块
+typedef struct SizeClassPage {
+    struct SizeClassPage* next;
+    struct SizeClassPage* prev;
+    MemoryChunk* free_chunks;   // 本页的空闲小块，单向链表
+    uint16_t in_use;            // 不在本页空闲链表中的小块数（已分配或在弹匣中）
+    uint16_t total;             // 本页的小块总数
+    uint8_t class_idx;
+} SizeClassPage;
+
+// 页描述符占用的空间，取整到16字节，使其后的小块保持对齐
+#define SIZE_CLASS_PAGE_HEADER ((sizeof(SizeClassPage) + MIN_ALLOC_SIZE - 1) & ~(MIN_ALLOC_SIZE - 1))
+
+// 按物理地址遍历大块得到的堆统计
+typedef struct HeapStats {
+    uint32_t chunk_count;       // 大块总数（含切分为小块的页）
+    uint32_t free_count;        // 空闲大块数
+    size_t free_bytes;          // 空闲大块总字节数
+    size_t largest_free;        // 最大空闲块
+    uint32_t fragmentation;     // 碎片率（百分比）：1 - 最大空闲块 / 空闲总量
+} HeapStats;
+
+// 弹匣：某个上下文私有的小块空闲栈，命中时无需获取类别锁
+typedef struct Magazine {
+    uint32_t count;
+    MemoryChunk* rounds[MAGAZINE_SIZE];
+} Magazine;
+
+// 分配上下文：每个大小类别一个弹匣
+typedef struct MallocContext {
+    Magazine magazines[NUM_SIZE_CLASSES];
+} MallocContext;
 
 // 为每个大小类别的空闲链表单独加锁
 typedef struct MemoryManager {
-    MemoryChunk* first;
-    MemoryChunk* free_lists[NUM_SIZE_CLASSES];
+    MemoryChunk* first;                                     // 堆中物理地址最低的块
+    size_t heap_end;                                        // 堆的结束地址
+    SizeClassPage* partial_pages[NUM_SIZE_CLASSES];         // 部分使用的页
+    SizeClassPage* empty_pages[NUM_SIZE_CLASSES];           // 完全空闲的页
+    uint32_t empty_page_count[NUM_SIZE_CLASSES];
+    uint32_t page_watermark;                                // 每个类别最多保留的空闲页数
+    uint32_t fl_bitmap;                                     // 第i位表示第i级有非空链表
+    uint32_t sl_bitmap[TLSF_FL_COUNT];                      // 每级中非空的二级链表
+    MemoryChunk* blocks[TLSF_FL_COUNT][TLSF_SL_COUNT];      // 大块空闲链表
     uint32_t large_lock;  // 大块内存的锁
     uint32_t class_locks[NUM_SIZE_CLASSES];  // 每个大小类别的锁
+    MallocContext* contexts[MALLOC_MAX_CONTEXTS];  // 按需创建的分配上下文
+    MemoryChunk* remote_frees[MALLOC_MAX_CONTEXTS]; // 其他上下文释放的小块，以CAS压入，所有者分配时整体取走
+    uint32_t current_context;                      // 当前上下文，由调度器切换
 } MemoryManager;
 
 
 extern void on_init_memory_manager(MemoryManager*, size_t first, size_t size);
 extern void* malloc(size_t size);
 extern void free(void* ptr);
+// 调整分配的大小：大块优先吞并物理上相邻的空闲块原地扩展，缩小时原地截断；
+// 不能用于kmalloc_aligned和kmalloc_pages返回的内存（移动后不再保持对齐）
+extern void* realloc(void* ptr, size_t size);
+// 分配count * size字节并清零，乘法溢出时返回NULL
+extern void* calloc(size_t count, size_t size);
+extern void print_memory_status();
+extern void malloc_get_heap_stats(HeapStats* stats);
+extern void malloc_set_page_watermark(uint32_t pages);
+
+// 对齐分配：align须为2的幂，返回的内存用free释放
+extern void* kmalloc_aligned(size_t size, size_t align);
+// 整页分配：页面框管理器可用时从伙伴分配器取物理连续的页，否则从堆中按页对齐分配，
+// 必须用kfree_pages以相同的页数释放
+extern void* kmalloc_pages(size_t count);
+extern void kfree_pages(void* pages, size_t count);
+
+// 分配上下文管理：调度器在切换进程时切换上下文，回收进程时归还其弹匣
+extern void malloc_switch_context(uint32_t context);
+extern void malloc_release_context(uint32_t context);
 
 // 辅助函数声明
 static size_t get_size_class_index(size_t size);
 static void* allocate_from_size_class(MemoryManager* manager, size_t size, size_t class_idx);
 static void refill_size_class(MemoryManager* manager, size_t class_idx);
+static MemoryChunk* allocate_large(MemoryManager* manager, size_t size);
+static void free_large(MemoryManager* manager, MemoryChunk* chunk);
 
 // 同时根据时间局部性原理和空间局部性原理，需要实现虚拟内存
 
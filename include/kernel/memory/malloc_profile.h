@@ -0,0 +1,43 @@
+#ifndef OS_KERNEL_MEMORY_MALLOC_PROFILE
+#define OS_KERNEL_MEMORY_MALLOC_PROFILE
+
+#include <stdtype.h>
+
+// 堆分配剖析：以 make MALLOC_PROFILE=1 构建（需先make clean）时，malloc/free把每次分配的
+// 调用者地址、大小类别和时间戳记录在一张固定大小的旁路表中，用于统计分配热点和查找泄漏。
+// 未开启时下列函数只打印提示。调用者地址可用 nm kernel.bin 对应到函数
+
+#define MALLOC_PROFILE_RECORDS_LOG2 12
+#define MALLOC_PROFILE_RECORDS (1 << MALLOC_PROFILE_RECORDS_LOG2)  // 同时跟踪的分配数上限
+#define MALLOC_PROFILE_SITES 64                                     // 统计的分配点数上限
+#define MALLOC_PROFILE_MAX_LISTED 64                                // 一次最多列出的分配数
+
+// 一次尚未释放的分配，address为0表示空槽
+typedef struct AllocRecord {
+    uint32_t address;           // 返回给调用者的地址
+    uint32_t caller;            // 调用malloc的返回地址
+    uint32_t size;              // 请求的大小
+    uint32_t timestamp;         // 分配时的TSC（右移16位）
+    uint16_t checkpoint;        // 分配时所处的检查点序号
+    uint8_t size_class;         // 大小类别，NUM_SIZE_CLASSES表示大块
+} AllocRecord;
+
+// 按调用者聚合的分配点
+typedef struct AllocSite {
+    uint32_t caller;
+    uint32_t count;
+    uint32_t bytes;
+} AllocSite;
+
+// 由malloc.c在分配和释放时调用
+extern void malloc_profile_record(void* address, size_t size, uint8_t size_class, uint32_t caller);
+extern void malloc_profile_forget(void* address);
+
+// 开始一个新的检查点，返回其序号
+extern uint32_t malloc_profile_checkpoint();
+// 按字节数和次数打印前count个分配点
+extern void malloc_profile_print_top(uint32_t count);
+// 列出在检查点[from, to)之间分配且仍未释放的内存
+extern void malloc_profile_print_outstanding(uint32_t from, uint32_t to);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef OS_KERNEL_MEMORY_PAGE_CACHE
+#define OS_KERNEL_MEMORY_PAGE_CACHE
+
+#include <stdtype.h>
+#include <fs/vfs.h>
+
+// 页缓存：内存映射文件的页面经由它读入，同一文件的同一页在所有映射之间共享一个页面框。
+// 每次查找路径都会得到新的Inode对象和新的文件操作表，因此文件以(ops->read, inode编号)识别。
+// 文件系统须为同一文件给出稳定的inode编号才能跨打开共享；目前VFS为每次查找分配新编号，
+// 共享只发生在同一次打开的各个映射（及fork复制的映射）之间。
+// 页缓存对其中的每个页面框持有一个引用，映射它的页表项各持有一个；
+// 文件的最后一个映射解除时写回脏页并丢弃全部页面
+
+#define PAGE_CACHE_BUCKETS 256              // 页面散列桶数，按(文件, 页号)散列
+
+struct PageCacheFile;
+
+// 缓存的一页
+typedef struct CachedPage {
+    struct PageCacheFile* file;
+    uint32_t index;                         // 文件内的页号
+    uint32_t frame;                         // 保存页面内容的页面框
+    uint32_t length;                        // 读入时属于文件的字节数，写回不超过它
+    uint8_t dirty;                          // 被共享映射写过，尚未写回
+    struct CachedPage* hash_next;           // 同一散列桶中的下一页
+    struct CachedPage* file_next;           // 同一文件的下一页
+} CachedPage;
+
+// 一个被映射的文件
+typedef struct PageCacheFile {
+    FileOperations ops;                     // 第一次映射时文件操作表的副本，关闭文件描述符后仍可用
+    uint32_t inode_num;
+    Inode* inode;                           // 读写页面时使用的inode，持有其引用
+    uint32_t ref_count;                     // 引用它的内存区域数
+    uint32_t page_count;
+    CachedPage* pages;
+    struct PageCacheFile* next;
+} PageCacheFile;
+
+// 取得inode对应文件的页缓存并增加引用，不支持读操作的文件返回NULL
+extern PageCacheFile* page_cache_get_file(Inode* inode);
+extern void page_cache_hold_file(PageCacheFile* file);
+// 释放一个引用，最后一个引用释放时写回脏页并丢弃全部页面
+extern void page_cache_put_file(PageCacheFile* file);
+// 取得文件第index页的页面框，不在缓存中时读入；返回的页面框归页缓存所有，
+// 映射前需用pfm_ref_frame增加引用。失败返回0
+extern uint32_t page_cache_get_page(PageCacheFile* file, uint32_t index);
+extern void page_cache_mark_dirty(PageCacheFile* file, uint32_t index);
+// 把文件的脏页写回
+extern void page_cache_sync(PageCacheFile* file);
+
+#endif
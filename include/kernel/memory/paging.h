@@ -2,9 +2,14 @@
 #define OS_KERNEL_MEMORY_PAGING_H
 
 #include <stdtype.h>
+#include <kernel/multiboot.h>
+#include <fs/vfs.h>
+#include <kernel/kerstd/rbtree.h>
 
 // 内核相关常量定义
 #define KERNEL_START_ADDRESS 0x0100000      // 内核起始地址（1MB）
+#define USER_SPACE_START 0x40000000         // 用户空间下限，其下为内核恒等映射的物理内存窗口
+#define USER_SPACE_END 0xC0000000           // 用户空间上限，其上（页目录项768起）为各进程共享的内核空间
 
 // 页表相关常量定义
 #define PAGE_SIZE 4096                      // 页大小为4KB
@@ -12,6 +17,19 @@
 #define PAGE_TABLE_ENTRIES 1024             // 页表项数量
 #define PAGE_MASK 0xFFFFF000                // 页掩码
 #define OFFSET_MASK 0x00000FFF              // 偏移量掩码
+#define LARGE_PAGE_SIZE 0x400000            // PSE大页为4MB，由一个页目录项直接映射
+#define LARGE_PAGE_MASK 0xFFC00000          // 大页掩码
+#define TLB_FLUSH_THRESHOLD 32              // 范围操作改动超过这么多页时重载CR3，否则逐页invlpg
+
+// 递归映射：每个页目录的最后一项指向自身，分页启用后当前地址空间的页表出现在
+// PD_SELF_TABLES起的4MB窗口中，页目录本身位于PD_SELF_DIRECTORY。
+// 其他页目录挂接在当前页目录的倒数第二项，经PD_FOREIGN_TABLES窗口访问
+#define PD_SELF_INDEX 1023
+#define PD_FOREIGN_INDEX 1022
+#define PD_SELF_TABLES 0xFFC00000
+#define PD_SELF_DIRECTORY 0xFFFFF000
+#define PD_FOREIGN_TABLES 0xFF800000
+#define PD_FOREIGN_DIRECTORY 0xFFFFE000
 
 // 页表项标志位定义
 #define PTE_PRESENT 0x001                   // 页面存在
@@ -25,6 +43,15 @@
 #define PTE_GLOBAL 0x100                    // 全局页
 #define PTE_PSE 0x080                       // 页大小扩展
 
+// PageTableEntry.available中的软件标志
+#define PTE_AVAIL_COW 0x1                   // 写时复制：只读且与其他地址空间共享，写入时复制
+#define PTE_AVAIL_SHARED 0x2                // 共享映射（MAP_SHARED文件页）：fork时保持共享而不改为写时复制
+
+// 页面故障错误码
+#define PF_PROTECTION 0x1                   // 0 = 页面不存在, 1 = 保护违例
+#define PF_WRITE 0x2                        // 写操作引起
+#define PF_USER 0x4                         // 用户模式下引起
+
 // 页表项结构
 typedef struct PageTableEntry {
     uint32_t present : 1;                   // 页面是否在物理内存中
@@ -82,39 +109,97 @@ typedef struct MemoryRegion {
     uint32_t size;                          // 区域大小
     uint32_t flags;                         // 区域标志
     MemoryRegionType type;                  // 区域类型
-    struct MemoryRegion* next;              // 指向下一个区域
+    struct PageCacheFile* file;             // 内存映射文件：页缓存中的文件，区域持有其引用
+    uint32_t file_offset;                   // 内存映射文件：区域起点对应的文件偏移（页对齐）
+    uint8_t shared;                         // 内存映射文件：MAP_SHARED，写入直接作用于页缓存
+    RBTNode node;                           // 进程区域树中的节点，键为virtual_address
 } MemoryRegion;
 
-// 页面框结构
+// 页面框描述符，4字节；物理地址由下标和base_frame算出，不再保存。
+// 空闲块的链表指针存放在块首页本身（分页启用前物理地址可直接访问），不占用描述符
 typedef struct PageFrame {
-    uint32_t physical_address;              // 物理地址
-    uint32_t reference_count;               // 引用计数
-    uint32_t flags;                         // 页面框标志
+    uint16_t reference_count;               // 引用计数
+    uint8_t flags;                          // 页面框标志
+    uint8_t order;                          // 空闲块首页：块的阶
 } PageFrame;
 
+// 空闲块首页开头的链表节点，链接的是页面框下标
+typedef struct FreeFrameLink {
+    uint32_t next;
+    uint32_t prev;
+} FreeFrameLink;
+
+// 伙伴分配器：把页面框按2的幂（阶）组成块，块按物理页号自然对齐，
+// 分配时拆分更大的块，释放时与同阶的伙伴合并
+#define PFM_MAX_ORDER 10                    // 最大阶，1024个页面框即4MB
+#define PFM_ORDER_COUNT (PFM_MAX_ORDER + 1)
+#define PFM_NO_FRAME 0xFFFFFFFF             // 空闲链表结束标记
+
+// 页面框标志
+#define PAGE_FRAME_FREE_BLOCK 0x01          // 该页面框是一个空闲块的首页
+
 // 页面框管理器结构
+// frame_bitmap每位对应一个页面框（1为已分配），用于检查释放是否合法；
+// 空闲的页面框都在free_lists中，order_bitmap的第k位表示k阶链表非空
 typedef struct PageFrameManager {
     uint32_t total_frames;                  // 总页面框数
     uint32_t free_frames;                   // 空闲页面框数
     uint32_t* frame_bitmap;                 // 页面框位图
+    uint32_t base_frame;                    // 第一个页面框的物理页号
+    uint32_t order_bitmap;                  // 非空的空闲链表
+    uint32_t free_lists[PFM_ORDER_COUNT];   // 各阶空闲块链表的表头
+    uint32_t free_blocks[PFM_ORDER_COUNT];  // 各阶空闲块数
+    uint32_t allocations[PFM_ORDER_COUNT];  // 各阶累计分配次数
     PageFrame* frames;                      // 页面框数组
 } PageFrameManager;
 
+// 物理地址区间[start, end)
+typedef struct PhysicalRange {
+    uint32_t start;
+    uint32_t end;
+} PhysicalRange;
+
+#define PFM_MAX_RESERVED 16                 // 初始化时可排除的保留区间数
+
 // 虚拟内存管理器结构
 typedef struct VirtualMemoryManager {
     PageFrameManager* frame_manager;        // 页面框管理器
     PageDirectory* kernel_directory;        // 内核页目录
     uint32_t kernel_start;                  // 内核起始地址
     uint32_t kernel_end;                    // 内核结束地址
+    uint32_t heap_end;                      // 内核堆结束地址
+    uint32_t identity_end;                  // [0, identity_end)被恒等映射，所有地址空间共享这些页目录项
 } VirtualMemoryManager;
 
 // 函数声明
 
 // 页面框管理函数
 extern void pfm_init(PageFrameManager* manager, uint32_t start_address, uint32_t size);
+// 按multiboot内存映射初始化，只管理可用且不在reserved中的页面框
+extern void pfm_init_from_multiboot(PageFrameManager* manager, MultibootInfo* info,
+                                    const PhysicalRange* reserved, uint32_t reserved_count);
 extern uint32_t pfm_allocate_frame();
 extern void pfm_free_frame(uint32_t frame_address);
 extern uint32_t pfm_get_free_frames_count();
+// 分配/释放2^order个物理上连续的页面框，首地址按块大小对齐
+extern uint32_t pfm_allocate_frames(uint32_t order);
+extern void pfm_free_frames(uint32_t frame_address, uint32_t order);
+// 容纳count个页面框所需的最小阶
+extern uint32_t pfm_order_for_count(uint32_t count);
+extern void pfm_print_status();
+// 共享页面框时增加引用计数，页面框不受管理或未分配时返回-1；共享者各自用pfm_free_frame释放
+extern int pfm_ref_frame(uint32_t frame_address);
+extern uint32_t pfm_get_reference_count(uint32_t frame_address);
+
+// 预先清零的页面框池：缺页时直接取用，由最低优先级的内核进程在空闲时补充
+#define PFM_ZEROED_POOL_SIZE 64             // 池容量
+#define PFM_ZEROED_RESERVE 256              // 空闲页面框不多于此数时不再补充
+// 取得一个内容全为0的页面框，池空时当场清零
+extern uint32_t pfm_allocate_zeroed_frame();
+// 补充最多count个清零的页面框，返回实际补充的个数
+extern uint32_t pfm_refill_zeroed_frames(uint32_t count);
+// 后台清零进程的入口
+extern int pfm_zero_frames_main(int argc, char** argv);
 
 // 页表管理函数
 extern PageDirectory* pd_create();
@@ -123,8 +208,19 @@ extern uint32_t pd_get_physical_address(PageDirectory* directory, uint32_t virtu
 extern void pd_switch(PageDirectory* directory);
 extern int pd_map_page(PageDirectory* directory, uint32_t virtual_address, uint32_t physical_address, uint32_t flags);
 extern int pd_unmap_page(PageDirectory* directory, uint32_t virtual_address);
+// 按范围映射/解除映射：每个4MB跨度只取一次页表，TLB在整个范围处理完后统一刷新，
+// 超过TLB_FLUSH_THRESHOLD页时重载CR3一次而不逐页invlpg。解除映射时归还页面框的引用
+extern int pd_map_range(PageDirectory* directory, uint32_t virtual_address, uint32_t physical_address, uint32_t size,
+                        uint32_t flags);
+extern int pd_unmap_range(PageDirectory* directory, uint32_t virtual_address, uint32_t size);
+// 用一个页目录项映射4MB大页，地址须按4MB对齐；目录项已指向页表时返回-1
+extern int pd_map_large_page(PageDirectory* directory, uint32_t virtual_address, uint32_t physical_address, uint32_t flags);
+// 按写时复制复制用户空间：页表逐个复制，页面框共享并增加引用计数，
+// 可写页面在两边都改为只读并标记PTE_AVAIL_COW
+extern PageDirectory* pd_clone(PageDirectory* source);
 
 // 虚拟内存管理函数
+extern void on_init_frame_manager(VirtualMemoryManager* manager, MultibootInfo* info, uint32_t heap_start, uint32_t heap_end);
 extern void on_init_virtual_memory_manager(VirtualMemoryManager* manager, uint32_t kernel_start, uint32_t kernel_end);
 extern int vmm_allocate_pages(PageDirectory* directory, uint32_t virtual_address, uint32_t size, uint32_t flags);
 extern int vmm_free_pages(PageDirectory* directory, uint32_t virtual_address, uint32_t size);
@@ -135,13 +231,39 @@ extern int vmm_unmap_pages(PageDirectory* directory, uint32_t virtual_address, u
 extern void page_fault_handler(uint32_t error_code);
 
 // 内存映射文件支持函数
-extern int vmm_map_file(PageDirectory* directory, const char* filename, uint32_t virtual_address, uint32_t flags);
-extern int vmm_unmap_file(PageDirectory* directory, uint32_t virtual_address);
+// 创建把inode从file_offset起映射到virtual_address的内存区域（由调用者加入进程的区域链表），
+// 页面在第一次访问时经页缓存读入。shared为真时各映射共享页缓存中的页面，否则写时复制
+extern MemoryRegion* vmm_map_file(Inode* inode, uint32_t virtual_address, uint32_t size, uint32_t file_offset,
+                                  uint32_t flags, int shared);
+// 解除文件区域中[virtual_address, virtual_address + size)的映射，共享映射的脏页写回文件
+extern int vmm_unmap_file(PageDirectory* directory, MemoryRegion* region, uint32_t virtual_address, uint32_t size);
 
 // 内存区域管理函数
 extern MemoryRegion* vmm_create_memory_region(uint32_t virtual_address, uint32_t size, uint32_t flags, MemoryRegionType type);
+// 销毁内存区域记录，同时释放其对映射文件的引用
 extern void vmm_destroy_memory_region(MemoryRegion* region);
 
+// 进程的内存区域以起始地址为键组织成红黑树。区域互不重叠，
+// 包含某地址的区域就是起始地址不大于它的最后一个区域
+// 插入区域并与相邻的同类区域合并（region可能因此被释放），与已有区域重叠时返回-1
+extern int vmm_insert_region(RBTree* regions, MemoryRegion* region);
+// 查找包含address的区域，不存在时返回NULL
+extern MemoryRegion* vmm_find_region(RBTree* regions, uint32_t address);
+// 按地址顺序遍历区域
+extern MemoryRegion* vmm_first_region(RBTree* regions);
+extern MemoryRegion* vmm_next_region(RBTree* regions, MemoryRegion* region);
+// 销毁全部区域记录并释放树的哨兵节点，不解除页面映射
+extern void vmm_destroy_regions(RBTree* regions);
+// 销毁进程的整个地址空间：写回共享文件映射的脏页，归还所有用户页面框的引用，
+// 释放页表、页目录和全部区域记录
+extern void vmm_destroy_address_space(PageDirectory* directory, RBTree* regions);
+// 解除[virtual_address, virtual_address + size)内的映射并移除区域记录，跨越边界的区域被拆分
+extern int vmm_unmap_regions(PageDirectory* directory, RBTree* regions, uint32_t virtual_address, uint32_t size);
+// 修改范围内区域的权限并更新已映射的页表项，跨越边界的区域被拆分，之后与相邻的同类区域合并。
+// 范围内有未登记的地址时返回-1
+extern int vmm_protect_regions(PageDirectory* directory, RBTree* regions, uint32_t virtual_address, uint32_t size,
+                               uint32_t flags);
+
 extern void enable_paging();
 extern void disable_paging();
 extern uint32_t get_current_page_directory();
@@ -0,0 +1,61 @@
+#ifndef OS_KERNEL_MEMORY_SLAB
+#define OS_KERNEL_MEMORY_SLAB
+
+#include <stdtype.h>
+
+// Slab分配器：为固定大小的内核对象提供类型化缓存
+// 每个slab占一个页，页首放slab描述符，对象本身不带任何头部，
+// 释放时通过对象地址按页对齐即可找到所属slab
+
+#define KMEM_CACHE_NAME_LEN 32
+#define KMEM_MIN_ALIGN 4            // 对象最小对齐，需能存放空闲链指针
+#define KMEM_COLOUR_ALIGN 32        // 着色步长，取一条缓存行
+#define KMEM_MAX_EMPTY_SLABS 1      // 每个缓存保留的空slab数，多余的归还
+
+// 对象构造函数：在slab创建时对每个对象调用一次，
+// 因此对象归还缓存时应保持构造后的状态。带构造函数的缓存把空闲链指针放在对象之后，
+// 不覆盖对象内容；没有构造函数时链接指针占用对象的第一个字
+typedef void (*kmem_ctor)(void* object);
+
+struct KmemCache;
+
+// slab描述符，位于slab页的起始处
+typedef struct KmemSlab {
+    struct KmemSlab* next;
+    struct KmemSlab* prev;
+    struct KmemCache* cache;        // 所属缓存
+    void* free_objects;             // 空闲对象链，链接指针位于对象内free_offset处
+    uint32_t in_use;                // 已分配的对象数
+} KmemSlab;
+
+// 对象缓存
+typedef struct KmemCache {
+    char name[KMEM_CACHE_NAME_LEN];
+    size_t object_size;             // 对齐后的对象大小（含对象之后的空闲链指针）
+    size_t free_offset;             // 空闲链指针相对对象起始的偏移
+    size_t align;                   // 对象对齐
+    size_t first_offset;            // 首个对象相对slab页的偏移（不含着色）
+    uint32_t objects_per_slab;      // 每个slab容纳的对象数
+    uint32_t colour_count;          // 可用的着色数
+    uint32_t colour_next;           // 下一个slab使用的着色
+    kmem_ctor ctor;                 // 对象构造函数，可为空
+
+    KmemSlab* partial;              // 部分使用的slab
+    KmemSlab* full;                 // 已满的slab
+    KmemSlab* empty;                // 空slab
+    uint32_t empty_count;
+
+    uint32_t slab_count;            // slab总数
+    uint32_t active_objects;        // 已分配的对象数
+    uint32_t lock;
+
+    struct KmemCache* next;         // 全局缓存链表
+} KmemCache;
+
+extern KmemCache* kmem_cache_create(const char* name, size_t size, size_t align, kmem_ctor ctor);
+extern void kmem_cache_destroy(KmemCache* cache);
+extern void* kmem_cache_alloc(KmemCache* cache);
+extern void kmem_cache_free(KmemCache* cache, void* object);
+extern void kmem_print_status();
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef OS_KERNEL_MULTIBOOT
+#define OS_KERNEL_MULTIBOOT
+
+#include <stdtype.h>
+
+// Multiboot（0.6.96）引导信息，由引导程序在%ebx中传入
+
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+// MultibootInfo.flags中表示对应字段有效的位
+#define MULTIBOOT_INFO_MEMORY 0x001         // mem_lower/mem_upper
+#define MULTIBOOT_INFO_CMDLINE 0x004        // cmdline
+#define MULTIBOOT_INFO_MODS 0x008           // mods_count/mods_addr
+#define MULTIBOOT_INFO_MEM_MAP 0x040        // mmap_length/mmap_addr
+
+// 内存映射项类型，只有AVAILABLE可以自由使用
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+#define MULTIBOOT_MEMORY_RESERVED 2
+#define MULTIBOOT_MEMORY_ACPI_RECLAIMABLE 3
+#define MULTIBOOT_MEMORY_NVS 4
+#define MULTIBOOT_MEMORY_BADRAM 5
+
+typedef struct MultibootInfo {
+    uint32_t flags;
+    uint32_t mem_lower;                     // 1MB以下的可用内存（KB）
+    uint32_t mem_upper;                     // 1MB起到第一个空洞的可用内存（KB）
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;                     // MultibootModule数组的物理地址
+    uint32_t syms[4];
+    uint32_t mmap_length;                   // 内存映射缓冲区的字节数
+    uint32_t mmap_addr;                     // 内存映射缓冲区的物理地址
+} __attribute__((packed)) MultibootInfo;
+
+// 内存映射项；size不包括size字段本身，遍历时下一项位于当前项 + size + 4
+typedef struct MultibootMmapEntry {
+    uint32_t size;
+    uint32_t addr_low;
+    uint32_t addr_high;
+    uint32_t len_low;
+    uint32_t len_high;
+    uint32_t type;
+} __attribute__((packed)) MultibootMmapEntry;
+
+typedef struct MultibootModule {
+    uint32_t mod_start;
+    uint32_t mod_end;                       // 不含
+    uint32_t string;
+    uint32_t reserved;
+} __attribute__((packed)) MultibootModule;
+
+// 链接脚本导出的内核映像边界（含.bss和启动栈）
+extern uint8_t kernel_image_start[];
+extern uint8_t kernel_image_end[];
+
+#endif
@@ -4,9 +4,9 @@
 #include <stdtype.h>
 #include <kernel/gdt.h>
 #include <kernel/memory/paging.h>
+#include <kernel/multitask/process_limits.h>
 
 // 进程相关常量定义
-#define PROCESS_MAX_COUNT 64          // 最大进程数量
 #define KERNEL_STACK_SIZE 4096        // 内核栈大小
 #define USER_STACK_SIZE 8192          // 用户栈大小
 #define USER_STACK_BASE 0x80000000    // 用户栈基地址（虚拟地址空间上限）
@@ -66,7 +66,7 @@ typedef struct Process {
     
     // 虚拟内存相关
     PageDirectory* page_directory;     // 进程页目录
-    MemoryRegion* memory_regions;      // 进程内存区域链表
+    RBTree memory_regions;             // 进程内存区域，以起始地址为键的红黑树
     
     // 参数和退出码
     int argc;                          // 参数数量
@@ -108,6 +108,8 @@ typedef struct ProcessManager {
 // 进程管理器接口函数
 void process_manager_init(ProcessManager* manager, struct GDT* gdt);
 uint32_t create_process(const char* name, int (*entry)(int, char**), int argc, char** argv, PrivilegeLevel privilege, uint32_t priority);
+// 写时复制地复制当前用户进程，子进程从state描述的现场开始运行，返回子进程PID
+uint32_t fork_process(const struct RegisterState* state);
 void terminate_process(uint32_t pid, int exit_code);
 void block_process(uint32_t pid, uint32_t wait_time);
 void unblock_process(uint32_t pid);
@@ -0,0 +1,7 @@
+#ifndef OS_KERNEL_MULTITASK_PROCESS_LIMITS_H
+#define OS_KERNEL_MULTITASK_PROCESS_LIMITS_H
+
+// 进程数量上限，单独放在无依赖的头文件中，供堆分配器等不能包含process.h的模块使用
+#define PROCESS_MAX_COUNT 64          // 最大进程数量
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef OS_KERNEL_SYNC
+#define OS_KERNEL_SYNC
+
+#include <stdtype.h>
+
+// 内核同步原语：自旋锁与本地中断开关
+
+static inline void acquire_lock(uint32_t *lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        asm volatile ("pause");
+    }
+}
+
+static inline void release_lock(uint32_t *lock) {
+    __sync_lock_release(lock);
+}
+
+#ifdef MALLOC_HOSTED
+
+// 宿主机基准测试构建（见bench/）：用户态不能关中断，以一把全局锁模拟单处理器上的关中断，
+// 由基准测试程序实现
+extern uint32_t hosted_irq_save();
+extern void hosted_irq_restore(uint32_t flags);
+
+static inline uint32_t local_irq_save() {
+    return hosted_irq_save();
+}
+
+static inline void local_irq_restore(uint32_t flags) {
+    hosted_irq_restore(flags);
+}
+
+#else
+
+// 保存EFLAGS并关闭本地中断。单处理器上每个上下文的私有数据只会被中断打断，
+// 关中断即可保证其操作的原子性，而无需任何锁
+static inline uint32_t local_irq_save() {
+    uint32_t flags;
+    asm volatile ("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void local_irq_restore(uint32_t flags) {
+    asm volatile ("push %0\n\tpopf" : : "r"(flags) : "memory", "cc");
+}
+
+#endif
+
+#endif
@@ -21,6 +21,7 @@
 #define SYS_mmap       90
 #define SYS_munmap     91
 #define SYS_printf     92
+#define SYS_mprotect   125
 
 // 内存保护标志定义
 #define PROT_READ    0x01  // 可读
@@ -34,6 +35,14 @@
 #define MAP_ANONYMOUS 0x04 // 匿名映射
 #define MAP_FIXED    0x10  // 固定地址映射
 
+// 系统调用入口（interruptstubs.s中的_handle_syscall）保存的现场，按压栈顺序由低地址到高地址
+typedef struct SyscallFrame {
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, kernel_esp, ebx, edx, ecx, eax;    // pushal
+    uint32_t eip, cs, eflags;                                   // CPU压入
+    uint32_t user_esp, user_ss;                                 // 仅从用户态进入时存在
+} __attribute__((packed)) SyscallFrame;
+
 // 系统调用表项类型定义
 typedef int (*syscall_handler)(uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4, uint32_t arg5);
 
@@ -55,9 +64,10 @@ extern int syscall_handler_sbrk(uint32_t increment, uint32_t unused1, uint32_t u
 extern int syscall_handler_yield(uint32_t unused1, uint32_t unused2, uint32_t unused3, uint32_t unused4, uint32_t unused5);
 extern int syscall_handler_mmap(uint32_t addr, uint32_t len, uint32_t prot, uint32_t flags, uint32_t fd);
 extern int syscall_handler_munmap(uint32_t addr, uint32_t len, uint32_t unused1, uint32_t unused2, uint32_t unused3);
+extern int syscall_handler_mprotect(uint32_t addr, uint32_t len, uint32_t prot, uint32_t unused1, uint32_t unused2);
 extern size_t syscall_handler_mm_size();
 
-// 系统调用入口点，在中断处理中调用
-extern uint32_t handle_syscall_interrupt(uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx, uint32_t esi, uint32_t edi);
+// 系统调用入口点，在中断处理中调用；eax为调用号，ebx～edi为参数，返回值写回frame->eax
+extern uint32_t handle_syscall_interrupt(SyscallFrame* frame);
 
 #endif // OS_KERNEL_SYSCALL
\ No newline at end of file
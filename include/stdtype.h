@@ -15,6 +15,7 @@ typedef unsigned long long int uint64_t;
 
 typedef const char *string;
 typedef uint32_t size_t;
+typedef __UINTPTR_TYPE__ uintptr_t;   // 与指针等宽的整数，宿主机构建（见bench/）中为64位
 
 typedef char* va_list;
 #define va_start(ap, last) (ap = (va_list)&last + sizeof(last))
@@ -8,7 +8,7 @@
 // 命令行最大长度
 #define MAX_COMMAND_LENGTH 256
 
-// 参数最大数量
+// 参数数组的初始容量，参数更多时用realloc扩展
 #define MAX_ARGS 16
 
 // Shell命令结构
@@ -52,6 +52,7 @@ extern int shell_cmd_touch(int argc, char** argv);
 extern int shell_cmd_rm(int argc, char** argv);
 extern int shell_cmd_ps(int argc, char** argv);
 extern int shell_cmd_memory(int argc, char** argv);
+extern int shell_cmd_heap(int argc, char** argv);
 
 extern ShellState g_shell_state;
 
@@ -154,10 +154,10 @@ static int block_dev_close(Inode* inode) {
         DeviceInfo* device_info = (DeviceInfo*)inode->private_data;
         if (device_info) {
             free(device_info);
+            inode->private_data = NULL;
         }
         
-        // 释放inode资源
-        free(inode);
+        // inode本身由vfs_close通过vfs_destroy_inode释放
     }
     return 0;
 }
@@ -223,10 +223,10 @@ static int char_dev_close(Inode* inode) {
         DeviceInfo* device_info = (DeviceInfo*)inode->private_data;
         if (device_info) {
             free(device_info);
+            inode->private_data = NULL;
         }
         
-        // 释放inode资源
-        free(inode);
+        // inode本身由vfs_close通过vfs_destroy_inode释放
     }
     return 0;
 }
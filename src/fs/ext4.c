@@ -3,6 +3,7 @@
 #include "../include/fs/vfs.h"
 #include "../include/kernel/string.h"
 #include "../include/kernel/memory/malloc.h"
+#include "../include/kernel/memory/slab.h"
 #include "../include/kernel/kerio.h"
 
 // 定义缺失的常量
@@ -24,11 +25,25 @@ typedef struct {
     uint32_t current_block;     // Current block being read
     uint32_t current_offset;    // Current offset within block
     uint8_t* block_buffer;      // Buffer for current block
+    Ext4Inode* ext4_inode;      // On-disk inode of the directory being read
 } Ext4DirIterator;
 
+// 目录的操作表：inode私有数据始终指向ops（VFS按FileOperations访问），
+// opendir分配的迭代器挂在其后，由closedir单独释放
+typedef struct {
+    FileOperations ops;         // 必须是第一个成员
+    Ext4DirIterator* iterator;  // opendir分配的迭代器，未打开时为NULL
+} Ext4DirOps;
+
 static FileSystem ext4_filesystem;
 static Ext4FileSystemData* ext4_fs_data = NULL;
 
+// 热点对象的缓存
+static KmemCache* ext4_inode_cache = NULL;
+static KmemCache* ext4_dir_iterator_cache = NULL;
+static KmemCache* ext4_file_ops_cache = NULL;
+static KmemCache* ext4_dir_ops_cache = NULL;
+
 // 函数声明
 uint32_t current_time();
 uint32_t ext4_allocate_inode();
@@ -38,6 +53,7 @@ void ext4_free_block(uint32_t block_num);
 void ext4_write_inode(Ext4FileSystemData* fs_data, uint32_t inode_num, Ext4Inode* inode);
 void ext4_write_super_block(Ext4FileSystemData* fs_data);
 int ext4_add_dir_entry(Inode* dir_inode, const char* name, uint32_t inode_num, FileType type);
+int ext4_dir_closedir(Inode* inode);
 
 // 读取超级块
 void ext4_read_super_block(Ext4FileSystemData* fs_data) {
@@ -90,7 +106,7 @@ void ext4_write_block(Ext4FileSystemData* fs_data, uint32_t block_num, const voi
 
 // 读取索引节点
 Ext4Inode* ext4_read_inode(Ext4FileSystemData* fs_data, uint32_t inode_num) {
-    Ext4Inode* inode = (Ext4Inode*)malloc(sizeof(Ext4Inode));
+    Ext4Inode* inode = (Ext4Inode*)kmem_cache_alloc(ext4_inode_cache);
     if (!inode) {
         return NULL;
     }
@@ -116,7 +132,7 @@ Ext4Inode* ext4_read_inode(Ext4FileSystemData* fs_data, uint32_t inode_num) {
     // 使用固定大小的缓冲区，避免分配过大的内存块
     uint8_t* block_buffer = (uint8_t*)malloc(MAX_DIR_BUFFER_SIZE);
     if (!block_buffer) {
-        free(inode);
+        kmem_cache_free(ext4_inode_cache, inode);
         return NULL;
     }
     
@@ -217,9 +233,10 @@ int ext4_file_close(Inode* inode) {
         return 0;
     }
     
-    // 释放索引节点数据
+    // 释放ext4_find_inode分配的文件操作表
     if (inode->private_data) {
-        free(inode->private_data);
+        kmem_cache_free(ext4_file_ops_cache, inode->private_data);
+        inode->private_data = NULL;
     }
     
     return 0;
@@ -390,7 +407,7 @@ extern int ext4_rmdir(const char* path) {
     // 使用固定大小的缓冲区，避免分配过大的内存块
     uint8_t* block_buffer = (uint8_t*)malloc(MAX_DIR_BUFFER_SIZE);
     if (!block_buffer) {
-        free(ext4_target_inode);
+        kmem_cache_free(ext4_inode_cache, ext4_target_inode);
         vfs_destroy_inode(target_inode);
         vfs_destroy_inode(parent_inode);
         free(parent_path);
@@ -430,7 +447,7 @@ extern int ext4_rmdir(const char* path) {
     if (entry_count != 2) {
         kernel_printf("EXT4: Directory '%s' is not empty\n", path);
         free(block_buffer);
-        free(ext4_target_inode);
+        kmem_cache_free(ext4_inode_cache, ext4_target_inode);
         vfs_destroy_inode(target_inode);
         vfs_destroy_inode(parent_inode);
         free(parent_path);
@@ -443,7 +460,7 @@ extern int ext4_rmdir(const char* path) {
     Ext4Inode* parent_ext4_inode = ext4_read_inode(ext4_fs_data, parent_inode->inode_num);
     if (!parent_ext4_inode) {
         free(block_buffer);
-        free(ext4_target_inode);
+        kmem_cache_free(ext4_inode_cache, ext4_target_inode);
         vfs_destroy_inode(target_inode);
         vfs_destroy_inode(parent_inode);
         free(parent_path);
@@ -481,8 +498,8 @@ extern int ext4_rmdir(const char* path) {
     if (!found) {
         kernel_printf("EXT4: Directory entry not found in parent directory\n");
         free(block_buffer);
-        free(ext4_target_inode);
-        free(parent_ext4_inode);
+        kmem_cache_free(ext4_inode_cache, ext4_target_inode);
+        kmem_cache_free(ext4_inode_cache, parent_ext4_inode);
         vfs_destroy_inode(target_inode);
         vfs_destroy_inode(parent_inode);
         free(parent_path);
@@ -511,8 +528,8 @@ extern int ext4_rmdir(const char* path) {
     
     // 清理资源
     free(block_buffer);
-    free(ext4_target_inode);
-    free(parent_ext4_inode);
+    kmem_cache_free(ext4_inode_cache, ext4_target_inode);
+    kmem_cache_free(ext4_inode_cache, parent_ext4_inode);
     vfs_destroy_inode(target_inode);
     vfs_destroy_inode(parent_inode);
     free(parent_path);
@@ -647,7 +664,7 @@ extern int ext4_remove(const char* path) {
             
             // 释放inode
             ext4_free_inode(target_inode_num);
-            free(target_inode);
+            kmem_cache_free(ext4_inode_cache, target_inode);
         }
         
         // 更新父目录的修改时间
@@ -662,7 +679,7 @@ extern int ext4_remove(const char* path) {
     
     // 清理资源
     free(block_buffer);
-    free(parent_ext4_inode);
+    kmem_cache_free(ext4_inode_cache, parent_ext4_inode);
     vfs_destroy_inode(parent_inode);
     free(parent_path);
     free(file_name);
@@ -672,7 +689,7 @@ extern int ext4_remove(const char* path) {
 
 // 打开目录
 extern int ext4_dir_opendir(Inode* inode) {
-    if (!inode || !ext4_fs_data) {
+    if (!inode || !ext4_fs_data || !inode->private_data) {
         return -1;
     }
     
@@ -681,36 +698,29 @@ extern int ext4_dir_opendir(Inode* inode) {
         return -1;
     }
     
+    // 重复打开时先释放旧的迭代器
+    Ext4DirOps* dir_ops = (Ext4DirOps*)inode->private_data;
+    ext4_dir_closedir(inode);
+    
     // 读取目录的EXT4 inode数据
     Ext4Inode* ext4_inode = ext4_read_inode(ext4_fs_data, inode->inode_num);
     if (!ext4_inode) {
         return -1;
     }
     
-    // 初始化目录迭代器
-    Ext4DirIterator* iterator = (Ext4DirIterator*)malloc(sizeof(Ext4DirIterator));
+    // 初始化目录迭代器，读取位置显式归零
+    Ext4DirIterator* iterator = (Ext4DirIterator*)kmem_cache_alloc(ext4_dir_iterator_cache);
     if (!iterator) {
-        free(ext4_inode);
+        kmem_cache_free(ext4_inode_cache, ext4_inode);
         return -1;
     }
     
     iterator->current_block = 0;
     iterator->current_offset = 0;
-    iterator->block_buffer = NULL;
-    
-    // 保存原始inode数据和迭代器到inode的私有数据
-    // 首先释放旧的私有数据
-    if (inode->private_data) {
-        free(inode->private_data);
-    }
-    
-    // 这里我们将ext4_inode和iterator都存储在private_data中
-    // 但在实际系统中，可能需要一个更复杂的结构来管理这些数据
-    inode->private_data = ext4_inode;
+    iterator->ext4_inode = ext4_inode;
     
-    // 存储迭代器在一个全局位置或专用结构中
-    // 注意：这个实现在多任务环境下可能存在问题，因为它使用了一个全局变量
-    // 在实际系统中，应该使用更安全的方式来管理目录迭代器
+    // 迭代器挂在目录操作表上，inode私有数据仍是操作表
+    dir_ops->iterator = iterator;
     
     // 更新目录的访问时间
     ext4_inode->atime = current_time();
@@ -721,28 +731,45 @@ extern int ext4_dir_opendir(Inode* inode) {
 
 // 关闭目录
 extern int ext4_dir_closedir(Inode* inode) {
-    if (!inode || !ext4_fs_data) {
+    if (!inode || !inode->private_data) {
         return -1;
     }
     
-    // Clean up directory iterator if it exists
-    Ext4DirIterator* iterator = (Ext4DirIterator*)inode->private_data;
+    // 只释放opendir分配的迭代器，操作表归inode所有
+    Ext4DirOps* dir_ops = (Ext4DirOps*)inode->private_data;
+    Ext4DirIterator* iterator = dir_ops->iterator;
     if (iterator) {
         // Free block buffer if allocated
         if (iterator->block_buffer) {
             free(iterator->block_buffer);
         }
         
-        // Free the iterator itself
-        free(iterator);
+        if (iterator->ext4_inode) {
+            kmem_cache_free(ext4_inode_cache, iterator->ext4_inode);
+        }
         
-        // Clear private_data to avoid dangling pointer
-        inode->private_data = NULL;
+        // Return the iterator to its cache in constructed (zeroed) state
+        memset(iterator, 0, sizeof(Ext4DirIterator));
+        kmem_cache_free(ext4_dir_iterator_cache, iterator);
+        
+        dir_ops->iterator = NULL;
     }
     
     return 0;
 }
 
+// 目录关闭操作：释放仍未关闭的迭代器及ext4_find_inode分配的目录操作表
+static int ext4_dir_close(Inode* inode) {
+    if (!inode || !inode->private_data) {
+        return 0;
+    }
+    
+    ext4_dir_closedir(inode);
+    kmem_cache_free(ext4_dir_ops_cache, inode->private_data);
+    inode->private_data = NULL;
+    return 0;
+}
+
 // 读取目录
 extern int ext4_dir_readdir(Inode* inode, char* name, size_t name_len, FileType* type) {
     if (!inode || !name || !type || !ext4_fs_data) {
@@ -754,32 +781,23 @@ extern int ext4_dir_readdir(Inode* inode, char* name, size_t name_len, FileType*
         return -1;
     }
     
-    Ext4Inode* ext4_inode = (Ext4Inode*)inode->private_data;
     uint32_t block_size = ext4_fs_data->block_size;
     
-    // Initialize directory iterator if it doesn't exist
-    Ext4DirIterator* iterator = (Ext4DirIterator*)inode->private_data;
-    if (!iterator) {
-        iterator = (Ext4DirIterator*)malloc(sizeof(Ext4DirIterator));
-        if (!iterator) {
-            return -1;
-        }
-        
-        iterator->current_block = 0;
-        iterator->current_offset = 0;
-        iterator->block_buffer = NULL;
-        
-        // Store iterator in inode's private_data
-        inode->private_data = iterator;
+    // The iterator is set up by ext4_dir_opendir
+    if (!inode->private_data) {
+        return -1;
+    }
+    Ext4DirIterator* iterator = ((Ext4DirOps*)inode->private_data)->iterator;
+    if (!iterator || !iterator->ext4_inode) {
+        return -1;
     }
+    Ext4Inode* ext4_inode = iterator->ext4_inode;
     
     // Allocate block buffer if not already allocated
     if (!iterator->block_buffer) {
         // 使用固定大小的缓冲区，避免分配过大的内存块
         iterator->block_buffer = (uint8_t*)malloc(MAX_DIR_BUFFER_SIZE);
         if (!iterator->block_buffer) {
-            free(iterator);
-            inode->private_data = NULL;
             return -1;
         }
     }
@@ -854,10 +872,9 @@ extern int ext4_dir_readdir(Inode* inode, char* name, size_t name_len, FileType*
         iterator->current_offset = 0;
     }
     
-    // No more entries found, reset iterator for next readdir sequence
-    free(iterator->block_buffer);
-    free(iterator);
-    inode->private_data = NULL;
+    // No more entries found, rewind iterator for next readdir sequence
+    iterator->current_block = 0;
+    iterator->current_offset = 0;
     
     return -1; // No more entries
 }
@@ -893,7 +910,7 @@ extern int ext4_file_open(Inode* inode, int flags) {
     ext4_write_inode(ext4_fs_data, inode->inode_num, ext4_inode);
     
     // 释放临时inode结构
-    free(ext4_inode);
+    kmem_cache_free(ext4_inode_cache, ext4_inode);
     
     return 0;
 }
@@ -985,7 +1002,7 @@ extern int ext4_mkdir(const char* path, uint32_t permissions) {
     }
     
     // 5. 创建新的目录inode并初始化
-    Ext4Inode* ext4_new_inode = (Ext4Inode*)malloc(sizeof(Ext4Inode));
+    Ext4Inode* ext4_new_inode = (Ext4Inode*)kmem_cache_alloc(ext4_inode_cache);
     if (!ext4_new_inode) {
         kernel_printf("EXT4: Memory allocation failed\n");
         ext4_free_block(data_block);
@@ -1013,7 +1030,7 @@ extern int ext4_mkdir(const char* path, uint32_t permissions) {
     // 使用固定大小的缓冲区，避免分配过大的内存块
     uint8_t* block_buffer = (uint8_t*)malloc(MAX_DIR_BUFFER_SIZE);
     if (!block_buffer) {
-        free(ext4_new_inode);
+        kmem_cache_free(ext4_inode_cache, ext4_new_inode);
         ext4_free_block(data_block);
         ext4_free_inode(new_inode_num);
         vfs_destroy_inode(parent_inode);
@@ -1052,7 +1069,7 @@ extern int ext4_mkdir(const char* path, uint32_t permissions) {
         parent_ext4_inode->links_count++;
         parent_ext4_inode->mtime = parent_ext4_inode->ctime = current_time();
         ext4_write_inode(ext4_fs_data, parent_inode->inode_num, parent_ext4_inode);
-        free(parent_ext4_inode);
+        kmem_cache_free(ext4_inode_cache, parent_ext4_inode);
     }
     
     // 9. 更新文件系统元数据
@@ -1063,7 +1080,7 @@ extern int ext4_mkdir(const char* path, uint32_t permissions) {
     
     // 清理资源
     free(block_buffer);
-    free(ext4_new_inode);
+    kmem_cache_free(ext4_inode_cache, ext4_new_inode);
     vfs_destroy_inode(parent_inode);
     free(parent_path);
     free(dir_name);
@@ -1104,7 +1121,7 @@ static Inode* ext4_find_inode(const char* path) {
         }
         
         // 设置文件操作函数
-        FileOperations* dir_ops = (FileOperations*)malloc(sizeof(FileOperations));
+        Ext4DirOps* dir_ops = (Ext4DirOps*)kmem_cache_alloc(ext4_dir_ops_cache);
         if (!dir_ops) {
             vfs_destroy_inode(current_inode);
             vfs_free_path_components(components, num_components);
@@ -1112,10 +1129,11 @@ static Inode* ext4_find_inode(const char* path) {
         }
         
         // 设置目录操作函数
-        memset(dir_ops, 0, sizeof(FileOperations));
-        dir_ops->opendir = ext4_dir_opendir;
-        dir_ops->closedir = ext4_dir_closedir;
-        dir_ops->readdir = ext4_dir_readdir;
+        memset(dir_ops, 0, sizeof(Ext4DirOps));
+        dir_ops->ops.opendir = ext4_dir_opendir;
+        dir_ops->ops.close = ext4_dir_close;
+        dir_ops->ops.closedir = ext4_dir_closedir;
+        dir_ops->ops.readdir = ext4_dir_readdir;
         
         current_inode->private_data = dir_ops;
     } else {
@@ -1130,7 +1148,7 @@ static Inode* ext4_find_inode(const char* path) {
         }
         
         // 设置文件操作函数
-        FileOperations* file_ops = (FileOperations*)malloc(sizeof(FileOperations));
+        FileOperations* file_ops = (FileOperations*)kmem_cache_alloc(ext4_file_ops_cache);
         if (!file_ops) {
             vfs_destroy_inode(current_inode);
             vfs_free_path_components(components, num_components);
@@ -1170,6 +1188,11 @@ Inode* ext4_get_inode(const char* path) {
     return inode;
 }
 
+// 目录迭代器的构造函数：缓存中的迭代器始终处于清零状态
+static void ext4_dir_iterator_ctor(void* object) {
+    memset(object, 0, sizeof(Ext4DirIterator));
+}
+
 // 初始化EXT4文件系统
 int ext4_init() {
     // 设置文件系统操作函数
@@ -1181,6 +1204,12 @@ int ext4_init() {
     ext4_filesystem.rmdir = ext4_rmdir;
     ext4_filesystem.remove = ext4_remove;
     
+    // 创建热点对象缓存
+    ext4_inode_cache = kmem_cache_create("ext4_inode", sizeof(Ext4Inode), 0, NULL);
+    ext4_dir_iterator_cache = kmem_cache_create("ext4_dir_iterator", sizeof(Ext4DirIterator), 0, ext4_dir_iterator_ctor);
+    ext4_file_ops_cache = kmem_cache_create("ext4_file_ops", sizeof(FileOperations), 0, NULL);
+    ext4_dir_ops_cache = kmem_cache_create("ext4_dir_ops", sizeof(Ext4DirOps), 0, NULL);
+    
     // 注册文件系统到VFS
     if (vfs_register_filesystem(&ext4_filesystem) != 0) {
         kernel_printf("Failed to register EXT4 file system\n");
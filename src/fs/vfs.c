@@ -1,5 +1,6 @@
 #include <fs/vfs.h>
 #include <kernel/memory/malloc.h>
+#include <kernel/memory/slab.h>
 #include <kernel/kerio.h>
 #include <kernel/string.h>
 
@@ -15,6 +16,9 @@ static uint32_t num_mount_points = 0;
 static uint32_t num_filesystems = 0;
 static uint32_t next_fd = 0;
 
+// inode的对象缓存
+static KmemCache* inode_cache = NULL;
+
 // 初始化VFS
 extern int vfs_init() {
     // 初始化文件描述符表
@@ -38,13 +42,15 @@ extern int vfs_init() {
         registered_filesystems[i] = NULL;
     }
     
+    inode_cache = kmem_cache_create("inode", sizeof(Inode), 0, NULL);
+    
     kernel_printf("VFS initialized successfully\n");
     return 0;
 }
 
 // 创建inode
 extern Inode* vfs_create_inode(FileType type, uint32_t permissions, void* private_data) {
-    Inode* inode = (Inode*)malloc(sizeof(Inode));
+    Inode* inode = (Inode*)kmem_cache_alloc(inode_cache);
     if (!inode) {
         return NULL;
     }
@@ -65,7 +71,7 @@ extern void vfs_destroy_inode(Inode* inode) {
     if (inode && inode->ref_count > 0) {
         inode->ref_count--;
         if (inode->ref_count == 0) {
-            free(inode);
+            kmem_cache_free(inode_cache, inode);
         }
     }
 }
@@ -544,6 +550,9 @@ extern int vfs_opendir(const char* path) {
         if (ops->closedir) {
             ops->closedir(inode);
         }
+        if (ops->close) {
+            ops->close(inode);
+        }
         vfs_destroy_inode(inode);
         return -1;
     }
@@ -30,6 +30,11 @@ uint32_t do_handle_interrupt(
             esp = manager->handlers[interrupt_number]->handle_interrupt_function(esp);
         }
     }
+    else if (interrupt_number == 0x0E)
+    {
+        // 页面故障：错误码由CPU压栈，位于保存的寄存器之后
+        page_fault_handler(((struct RegisterState *)esp)->error);
+    }
     else if (interrupt_number != INTERRUPT_OFFSET)
     {
         
@@ -86,8 +86,6 @@ _handle_syscall:
     popl %ds
     popal
     
-    add $4, %esp
-    
     sti
     iret
 
@@ -4,6 +4,8 @@
 #include <kernel/interrupt/interrupt.h>
 #include <kernel/pic.h>
 #include <kernel/memory/malloc.h>
+#include <kernel/memory/paging.h>
+#include <kernel/multiboot.h>
 #include <kernel/multitask/process.h>
 #include <driver/driver.h>
 #include <driver/block.h>
@@ -47,6 +49,9 @@ void init_user_mode(){
     kernel_printf("Initializing system calls...\n");
     syscall_init();
 
+    // 后台清零进程，最低优先级，只在空闲时运行
+    create_process("zerod", pfm_zero_frames_main, 0, NULL, KERNEL_MODE, MAX_PRIORITY_LEVELS - 1);
+
     // 检查是否需要启动安装程序
     // 这里简化处理，实际可以从启动参数中获取
     extern int installer_main(int argc, char** argv);
@@ -79,6 +84,9 @@ typedef struct Core{
     ProcessManager process_manager;
 } Core;
 
+// 堆的起始地址，之前的内存（内核映像之外）由页面框管理器管理
+#define KERNEL_HEAP_START (10 * 1024 * 1024)
+
 uint32_t memupper_global;
 size_t memory_size;
 
@@ -93,27 +101,51 @@ int on_init_core(Core* core,void *multiboot_structure, unsigned int magic_number
     on_init_driver_manager(&core->driver_manager); // 传递结构体指针
 
     // 先初始化内存管理器，因为任务管理器需要分配内存
-    size_t heap = 10 * 1024 * 1024; // 从10MB开始
-    uint32_t *memupper = (uint32_t *)((size_t)multiboot_structure + 8);
+    MultibootInfo* info = (MultibootInfo*)multiboot_structure;
+    size_t heap = KERNEL_HEAP_START;
     
     // 添加调试信息
-    kernel_printf("Multiboot structure address: %x\n", multiboot_structure);
-    kernel_printf("memupper address: %x\n", memupper);
-    kernel_printf("memupper value: %d KB\n", *memupper);
-    kernel_printf("Total memory: %d MB\n", (*memupper) / 1024);
-    memupper_global = *memupper;
-    
-    // 计算可用内存大小 - 正确的公式应该是从heap开始到memupper*1024的所有内存
-    memory_size = (*memupper) * 1024 - heap;
+    kernel_printf("Multiboot structure address: %x, flags: %x\n", info, info->flags);
+    kernel_printf("memupper value: %d KB\n", info->mem_upper);
+    kernel_printf("Total memory: %d MB\n", info->mem_upper / 1024);
+    memupper_global = info->mem_upper;
+    
+    // 堆位于包含堆起点的可用区域内，没有内存映射时按mem_upper估计（1MB + mem_upper）
+    size_t region_end = 0x100000 + info->mem_upper * 1024;
+    if (info->flags & MULTIBOOT_INFO_MEM_MAP) {
+        for (uint32_t offset = 0; offset < info->mmap_length; ) {
+            MultibootMmapEntry* entry = (MultibootMmapEntry*)(info->mmap_addr + offset);
+            offset += entry->size + sizeof(entry->size);
+            if (entry->addr_high == 0) {
+                kernel_printf("mmap: base %x, length %x, type %d\n", entry->addr_low, entry->len_low, entry->type);
+            }
+            
+            size_t end = (entry->len_high != 0 || entry->addr_low + entry->len_low < entry->addr_low)
+                ? 0xFFFFF000 : entry->addr_low + entry->len_low;
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE && entry->addr_high == 0 &&
+                entry->addr_low <= heap && end > heap) {
+                region_end = end;
+            }
+        }
+    }
+    
+    // 内核只能直接访问用户空间下限以下的物理内存，区域超出部分不参与划分
+    if (region_end > USER_SPACE_START) {
+        region_end = USER_SPACE_START;
+    }
+    
+    // 堆取该区域的一半，其余内存交给页面框管理器
+    memory_size = region_end > heap ? ((region_end - heap) / 2) & 0xFFFFF000 : 0;
     kernel_printf("Heap start: %x\n", heap);
     kernel_printf("Heap size: %d bytes\n", memory_size);
     kernel_printf("Memory manager will manage memory from %x to %x\n", heap, heap + memory_size);
 
     on_init_memory_manager(&core->memory_manager, heap, memory_size);
+    on_init_frame_manager(&core->virtual_memory_manager, info, heap, heap + memory_size);
     
     // 初始化虚拟内存管理器
-    uint32_t kernel_start = 0x0100000;
-    uint32_t kernel_end = heap;       // 内核结束于堆的起始位置
+    uint32_t kernel_start = (uint32_t)kernel_image_start;
+    uint32_t kernel_end = (uint32_t)kernel_image_end;
     //on_init_virtual_memory_manager(&core->virtual_memory_manager, kernel_start, kernel_end);
 
     process_manager_init(&core->process_manager, &core->gdt);
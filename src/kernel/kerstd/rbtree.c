@@ -1,4 +1,4 @@
-#include <kernel/rbtree.h>
+#include <kernel/kerstd/rbtree.h>
 #include <kernel/memory/malloc.h>
 #include <kernel/string.h>
 
@@ -324,4 +324,54 @@ RBTNode* rbtree_maximum(RBTree* tree, RBTNode* node) {
         node = node->right;
     }
     return node;
-}
\ No newline at end of file
+}
+
+// 最小节点
+RBTNode* rbtree_first(RBTree* tree) {
+    return (tree->root == tree->nil) ? NULL : rbtree_minimum(tree, tree->root);
+}
+
+// 键不大于key的最大节点
+RBTNode* rbtree_floor(RBTree* tree, uint32_t key) {
+    RBTNode* current = tree->root;
+    RBTNode* result = NULL;
+    
+    while (current != tree->nil) {
+        if (current->key <= key) {
+            result = current;
+            current = current->right;
+        } else {
+            current = current->left;
+        }
+    }
+    
+    return result;
+}
+
+// 中序遍历的后继
+RBTNode* rbtree_next(RBTree* tree, RBTNode* node) {
+    if (node->right != tree->nil) {
+        return rbtree_minimum(tree, node->right);
+    }
+    
+    RBTNode* parent = node->parent;
+    while (parent != tree->nil && node == parent->right) {
+        node = parent;
+        parent = parent->parent;
+    }
+    return (parent == tree->nil) ? NULL : parent;
+}
+
+// 中序遍历的前驱
+RBTNode* rbtree_prev(RBTree* tree, RBTNode* node) {
+    if (node->left != tree->nil) {
+        return rbtree_maximum(tree, node->left);
+    }
+    
+    RBTNode* parent = node->parent;
+    while (parent != tree->nil && node == parent->left) {
+        node = parent;
+        parent = parent->parent;
+    }
+    return (parent == tree->nil) ? NULL : parent;
+}
@@ -1,218 +1,745 @@
 #include <kernel/memory/malloc.h>
+#include <kernel/memory/paging.h>
+#include <kernel/memory/malloc_profile.h>
 #include <kernel/kerio.h>
+#include <kernel/string.h>
+#include <kernel/sync.h>
 
 static MemoryManager* activate_memory_manager = 0;
 
-static void acquire_lock(uint32_t *lock) {
-    while (__sync_lock_test_and_set(lock, 1)) {
-        asm volatile ("pause");
+static void release_chunk(MemoryManager* manager, MemoryChunk* chunk);
+
+#ifdef MALLOC_HARDEN
+
+static uint32_t heap_canary_secret = 0;
+
+// 已分配块的next字段不使用，存放由块地址、大小、类别和启动时的随机数算出的金丝雀值，
+// 块头任一字段被改写都会使校验失败，而校验无需访问块以外的内存
+static inline MemoryChunk* chunk_canary(MemoryChunk* chunk) {
+    return (MemoryChunk *)(((uintptr_t)chunk ^ heap_canary_secret ^ (chunk->size * 0x9E3779B1U) ^ chunk->size_class) | 1);
+}
+
+static void __attribute__((noinline, cold)) heap_corrupted(const char* what, void* ptr, uint32_t caller) {
+    kernel_printf("heap: %s, ptr %x, caller %x\n", what, ptr, caller);
+}
+
+// 用毒化值填充数据区开头，分配时检查它是否被改写。块至少有MIN_ALLOC_SIZE字节，无需判断大小
+static inline void poison_chunk(MemoryChunk* chunk) {
+    uint32_t *word = (uint32_t *)((uintptr_t)chunk + sizeof(MemoryChunk));
+    for (size_t i = 0; i < MALLOC_POISON_BYTES / sizeof(uint32_t); i++) {
+        word[i] = MALLOC_POISON;
     }
 }
 
-static void release_lock(uint32_t *lock) {
-    __sync_lock_release(lock);
+static inline int poison_intact(MemoryChunk* chunk) {
+    uint32_t *word = (uint32_t *)((uintptr_t)chunk + sizeof(MemoryChunk));
+    uint32_t diff = 0;
+    for (size_t i = 0; i < MALLOC_POISON_BYTES / sizeof(uint32_t); i++) {
+        diff |= word[i] ^ MALLOC_POISON;
+    }
+    return diff == 0;
+}
+
+// 大块交给调用者前写入金丝雀。小块的next字段只在空闲链表中被占用，金丝雀在块离开
+// 所属页或远程释放链表时写入，在弹匣中周转时保持不变，分配的快速路径无需任何操作
+static inline void harden_on_alloc(void* ptr) {
+    MemoryChunk *chunk = (MemoryChunk *)((uintptr_t)ptr - sizeof(MemoryChunk));
+    chunk->next = chunk_canary(chunk);
+}
+
+// 释放前校验块头，返回0表示不应释放（宁可泄漏也不破坏空闲链表）。
+// 内联到释放路径中，正常情况下只有几次比较，报告放在冷路径
+static inline int harden_check_chunk(MemoryManager* manager, void* ptr, uint32_t caller) {
+    MemoryChunk *chunk = (MemoryChunk *)((uintptr_t)ptr - sizeof(MemoryChunk));
+    
+    if (__builtin_expect((uintptr_t)chunk < (uintptr_t)manager->first || (uintptr_t)ptr >= manager->heap_end, 0)) {
+        heap_corrupted("pointer not from the heap", ptr, caller);
+        return 0;
+    }
+    if (__builtin_expect(chunk->allocated != 1, 0)) {
+        heap_corrupted("double free", ptr, caller);
+        return 0;
+    }
+    if (__builtin_expect(chunk->next != chunk_canary(chunk), 0)) {
+        heap_corrupted("chunk header corrupted", ptr, caller);
+        return 0;
+    }
+    return 1;
 }
 
+#endif
+
+// 大小到类别的查找表，以(size + 15) >> 4为下标，由size_classes生成
+static const uint8_t size_class_lookup[(SIZE_CLASS_MAX >> 4) + 1] = {
+     0,  0,  1,  2,  3,  4,  5,  6,  7,  8,  8,  9,  9, 10, 10, 11,
+    11, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15,
+    15, 16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 17, 17,
+    17, 18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19,
+    19, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
+    20, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21,
+    21, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
+    22, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+    23
+};
+
 // 根据大小获取对应的类别索引
 static size_t get_size_class_index(size_t size) {
-    for (size_t i = 0; i < NUM_SIZE_CLASSES; i++) {
-        if (size <= size_classes[i]) {
-            return i;
+    if (size > SIZE_CLASS_MAX) {
+        return NUM_SIZE_CLASSES; // 表示是大块分配
+    }
+    return size_class_lookup[(size + MIN_ALLOC_SIZE - 1) >> 4];
+}
+
+// 最高位与最低位的位置，参数必须非零
+static inline uint32_t tlsf_fls(uint32_t word) {
+    return 31 - __builtin_clz(word);
+}
+
+static inline uint32_t tlsf_ffs(uint32_t word) {
+    return __builtin_ctz(word);
+}
+
+// 块大小到(一级, 二级)链表下标的映射
+static void tlsf_mapping_insert(size_t size, uint32_t* fl, uint32_t* sl) {
+    if (size < TLSF_SMALL_BLOCK) {
+        *fl = 0;
+        *sl = size >> TLSF_ALIGN_LOG2;
+    } else {
+        uint32_t bit = tlsf_fls(size);
+        *sl = (size >> (bit - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+        *fl = bit - (TLSF_FL_SHIFT - 1);
+    }
+}
+
+// 查找时先把大小向上取整到下一个二级区间，保证找到的链表中任意块都足够大
+static void tlsf_mapping_search(size_t size, uint32_t* fl, uint32_t* sl) {
+    if (size >= TLSF_SMALL_BLOCK) {
+        size += (1 << (tlsf_fls(size) - TLSF_SL_LOG2)) - 1;
+    }
+    tlsf_mapping_insert(size, fl, sl);
+}
+
+static void tlsf_insert_block(MemoryManager* manager, MemoryChunk* chunk) {
+    uint32_t fl, sl;
+    tlsf_mapping_insert(chunk->size, &fl, &sl);
+    
+    chunk->prev = 0;
+    chunk->next = manager->blocks[fl][sl];
+    if (chunk->next) {
+        chunk->next->prev = chunk;
+    }
+    manager->blocks[fl][sl] = chunk;
+    
+    manager->fl_bitmap |= 1U << fl;
+    manager->sl_bitmap[fl] |= 1U << sl;
+}
+
+static void tlsf_remove_block(MemoryManager* manager, MemoryChunk* chunk) {
+    uint32_t fl, sl;
+    tlsf_mapping_insert(chunk->size, &fl, &sl);
+    
+    if (chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        manager->blocks[fl][sl] = chunk->next;
+    }
+    if (chunk->next) {
+        chunk->next->prev = chunk->prev;
+    }
+    chunk->prev = 0;
+    chunk->next = 0;
+    
+    // 链表变空时清除对应的位
+    if (manager->blocks[fl][sl] == 0) {
+        manager->sl_bitmap[fl] &= ~(1U << sl);
+        if (manager->sl_bitmap[fl] == 0) {
+            manager->fl_bitmap &= ~(1U << fl);
+        }
+    }
+}
+
+// 在不小于(fl, sl)的链表中找第一个非空链表
+static MemoryChunk* tlsf_find_block(MemoryManager* manager, uint32_t fl, uint32_t sl) {
+    uint32_t sl_map = manager->sl_bitmap[fl] & (~0U << sl);
+    if (sl_map == 0) {
+        uint32_t fl_map = manager->fl_bitmap & (~0U << (fl + 1));
+        if (fl_map == 0) {
+            return 0;
         }
+        fl = tlsf_ffs(fl_map);
+        sl_map = manager->sl_bitmap[fl];
     }
-    return NUM_SIZE_CLASSES; // 表示是大块分配
+    sl = tlsf_ffs(sl_map);
+    return manager->blocks[fl][sl];
 }
 
-// 从特定大小类别的空闲链表中分配内存
+// 物理上紧随其后的块
+static inline MemoryChunk* next_physical_chunk(MemoryChunk* chunk) {
+    return (MemoryChunk *)((uintptr_t)chunk + sizeof(MemoryChunk) + chunk->size);
+}
+
+// 空闲大块在数据区末尾写入指向自身头部的脚标，后继块据此在常数时间内找到它
+static inline void set_footer(MemoryChunk* chunk) {
+    *(MemoryChunk **)((uintptr_t)next_physical_chunk(chunk) - sizeof(MemoryChunk *)) = chunk;
+}
+
+static inline MemoryChunk* prev_physical_chunk(MemoryChunk* chunk) {
+    return *(MemoryChunk **)((uintptr_t)chunk - sizeof(MemoryChunk *));
+}
+
+// 从空闲链表中摘下一个不小于size的块，调用者需持有大块锁
+static MemoryChunk* take_free_block(MemoryManager* manager, size_t size) {
+    if (size >= TLSF_MAX_ALLOC) {
+        return 0;
+    }
+    
+    uint32_t fl, sl;
+    tlsf_mapping_search(size, &fl, &sl);
+    if (fl >= TLSF_FL_COUNT) {
+        return 0;
+    }
+    
+    MemoryChunk *chunk = tlsf_find_block(manager, fl, sl);
+    if (chunk != 0) {
+        tlsf_remove_block(manager, chunk);
+    }
+    return chunk;
+}
+
+// 把摘下的空闲块截为size并标记为已分配，剩余部分（如果够大）放回空闲链表
+static void use_free_block(MemoryManager* manager, MemoryChunk* chunk, size_t size) {
+    if (chunk->size >= size + sizeof(MemoryChunk) + MIN_ALLOC_SIZE) {
+        MemoryChunk *remaining = (MemoryChunk *)((uintptr_t)chunk + sizeof(MemoryChunk) + size);
+        remaining->allocated = 0;
+        remaining->prev_free = 0;
+        remaining->size = chunk->size - size - sizeof(MemoryChunk);
+        remaining->size_class = NUM_SIZE_CLASSES;
+        set_footer(remaining);
+        tlsf_insert_block(manager, remaining);
+        
+        chunk->size = size;
+    } else {
+        next_physical_chunk(chunk)->prev_free = 0;
+    }
+    
+    chunk->allocated = 1;
+    chunk->size_class = NUM_SIZE_CLASSES;
+}
+
+// 分配一个大块，调用者需持有大块锁
+static MemoryChunk* allocate_large(MemoryManager* manager, size_t size) {
+    MemoryChunk *chunk = take_free_block(manager, size);
+    if (chunk == 0) {
+        return 0;
+    }
+    
+    use_free_block(manager, chunk, size);
+    return chunk;
+}
+
+// 分配数据区按align对齐的大块，调用者需持有大块锁。
+// 多取align加一个最小块的余量，对齐点之前的间隙作为空闲块放回链表
+static MemoryChunk* allocate_large_aligned(MemoryManager* manager, size_t size, size_t align) {
+    size_t min_gap = sizeof(MemoryChunk) + MIN_ALLOC_SIZE;
+    if (size >= TLSF_MAX_ALLOC || align >= TLSF_MAX_ALLOC) {
+        return 0;
+    }
+    
+    MemoryChunk *chunk = take_free_block(manager, size + align + min_gap);
+    if (chunk == 0) {
+        return 0;
+    }
+    
+    // 间隙要么为0，要么足够容纳一个空闲块
+    size_t payload = (uintptr_t)chunk + sizeof(MemoryChunk);
+    size_t aligned = (payload + align - 1) & ~(align - 1);
+    while (aligned != payload && aligned - payload < min_gap) {
+        aligned += align;
+    }
+    
+    if (aligned != payload) {
+        size_t gap = aligned - payload;
+        MemoryChunk *aligned_chunk = (MemoryChunk *)(aligned - sizeof(MemoryChunk));
+        aligned_chunk->size = chunk->size - gap;
+        aligned_chunk->prev_free = 1;
+        
+        // 原块的前部成为独立的空闲块，前驱不可能空闲，无需合并
+        chunk->size = gap - sizeof(MemoryChunk);
+        chunk->allocated = 0;
+        chunk->size_class = NUM_SIZE_CLASSES;
+        set_footer(chunk);
+        tlsf_insert_block(manager, chunk);
+        
+        chunk = aligned_chunk;
+    }
+    
+    use_free_block(manager, chunk, size);
+    return chunk;
+}
+
+// 释放一个大块并与物理上相邻的空闲块合并，调用者需持有大块锁。
+// 相邻的空闲块总会被合并，因此前后各最多合并一次
+static void free_large(MemoryManager* manager, MemoryChunk* chunk) {
+    chunk->allocated = 0;
+    
+    // 通过前一个块的脚标向前合并
+    if (chunk->prev_free) {
+        MemoryChunk *prev = prev_physical_chunk(chunk);
+        tlsf_remove_block(manager, prev);
+        prev->size += chunk->size + sizeof(MemoryChunk);
+        chunk = prev;
+    }
+    
+    // 向后合并；堆尾有一个已分配的哨兵块，不会越界
+    MemoryChunk *next = next_physical_chunk(chunk);
+    if (!next->allocated) {
+        tlsf_remove_block(manager, next);
+        chunk->size += next->size + sizeof(MemoryChunk);
+        next = next_physical_chunk(chunk);
+    }
+    
+    set_footer(chunk);
+    next->prev_free = 1;
+    tlsf_insert_block(manager, chunk);
+}
+
+static void page_list_remove(SizeClassPage** list, SizeClassPage* page) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        *list = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+    page->next = 0;
+    page->prev = 0;
+}
+
+static void page_list_push(SizeClassPage** list, SizeClassPage* page) {
+    page->prev = 0;
+    page->next = *list;
+    if (*list) {
+        (*list)->prev = page;
+    }
+    *list = page;
+}
+
+// 从类别的页中取一个空闲小块，优先使用部分使用的页，让空闲页有机会被归还。
+// 调用者需持有类别锁
+static MemoryChunk* class_pop_chunk(MemoryManager* manager, size_t class_idx) {
+    SizeClassPage *page = manager->partial_pages[class_idx];
+    if (page == 0) {
+        page = manager->empty_pages[class_idx];
+        if (page == 0) {
+            return 0;
+        }
+        page_list_remove(&manager->empty_pages[class_idx], page);
+        manager->empty_page_count[class_idx]--;
+        page_list_push(&manager->partial_pages[class_idx], page);
+    }
+    
+    MemoryChunk *chunk = page->free_chunks;
+    page->free_chunks = chunk->next;
+    page->in_use++;
+#ifdef MALLOC_HARDEN
+    // 毒化推迟到块回到所属页时进行，弹匣中周转的块不毒化也不检查，快速路径不触及数据区
+    if (!poison_intact(chunk)) {
+        heap_corrupted("write after free", (void *)((uintptr_t)chunk + sizeof(MemoryChunk)), 0);
+    }
+    chunk->next = chunk_canary(chunk);
+#endif
+    
+    // 已满的页不在任何链表中，释放其中的块时再放回
+    if (page->free_chunks == 0) {
+        page_list_remove(&manager->partial_pages[class_idx], page);
+    }
+    return chunk;
+}
+
+// 将小块放回所属页。页完全空闲且空闲页数已达水位线时，将页摘下并返回，
+// 由调用者在释放类别锁后归还大块分配器。调用者需持有类别锁
+static SizeClassPage* class_push_chunk(MemoryManager* manager, MemoryChunk* chunk) {
+    SizeClassPage *page = chunk->page;
+    size_t class_idx = page->class_idx;
+    
+    if (page->free_chunks == 0) {
+        page_list_push(&manager->partial_pages[class_idx], page);
+    }
+    
+    chunk->allocated = 0;
+#ifdef MALLOC_HARDEN
+    poison_chunk(chunk);
+#endif
+    chunk->next = page->free_chunks;
+    page->free_chunks = chunk;
+    page->in_use--;
+    
+    if (page->in_use > 0) {
+        return 0;
+    }
+    
+    page_list_remove(&manager->partial_pages[class_idx], page);
+    if (manager->empty_page_count[class_idx] < manager->page_watermark) {
+        page_list_push(&manager->empty_pages[class_idx], page);
+        manager->empty_page_count[class_idx]++;
+        return 0;
+    }
+    return page;
+}
+
+// 将摘下的页（以next串成链表）归还大块分配器
+static void release_class_pages(MemoryManager* manager, SizeClassPage* pages) {
+    if (pages == 0) {
+        return;
+    }
+    
+    acquire_lock(&manager->large_lock);
+    while (pages != 0) {
+        SizeClassPage *next = pages->next;
+        free_large(manager, (MemoryChunk *)((uintptr_t)pages - sizeof(MemoryChunk)));
+        pages = next;
+    }
+    release_lock(&manager->large_lock);
+}
+
+// 从特定大小类别的页中分配内存
 static void* allocate_from_size_class(MemoryManager* manager, size_t size, size_t class_idx) {
     if (class_idx >= NUM_SIZE_CLASSES) {
         // 大块分配，需要获取大块锁
         acquire_lock(&manager->large_lock);
+        MemoryChunk *chunk = allocate_large(manager, size);
+        release_lock(&manager->large_lock);
         
-        MemoryChunk *best_fit = 0;
-        MemoryChunk *prev = 0;
-        MemoryChunk *current = manager->first;
-        
-        while (current != 0) {
-            if (!current->allocated && current->size >= size) {
-                if (best_fit == 0 || current->size < best_fit->size) {
-                    best_fit = current;
-                }
-            }
-            current = current->next;
-        }
-        
-        if (best_fit == 0) {
-            release_lock(&manager->large_lock);
+        if (chunk == 0) {
             kernel_printf("allocate_from_size_class: no memory for size %d\n", size);
             return 0;
         }
-        
-        // 从链表中移除找到的块
-        if (best_fit->prev) {
-            best_fit->prev->next = best_fit->next;
-        } else {
-            manager->first = best_fit->next;
-        }
-        
-        if (best_fit->next) {
-            best_fit->next->prev = best_fit->prev;
-        }
-        
-        // 分割块（如果需要）
-        if (best_fit->size >= size + sizeof(MemoryChunk) + MIN_ALLOC_SIZE) {
-            MemoryChunk *temp = (MemoryChunk *)((size_t)best_fit + sizeof(MemoryChunk) + size);
-            temp->allocated = 0;
-            temp->size = best_fit->size - size - sizeof(MemoryChunk);
-            temp->size_class = NUM_SIZE_CLASSES;
-            temp->prev = 0;
-            temp->next = manager->first;
-            
-            if (manager->first) {
-                manager->first->prev = temp;
-            }
-            manager->first = temp;
-            
-            best_fit->size = size;
-        }
-        
-        best_fit->allocated = 1;
-        best_fit->size_class = NUM_SIZE_CLASSES;
-        best_fit->prev = 0;
-        best_fit->next = 0;
-        
-        release_lock(&manager->large_lock);
-        return (void *)((size_t)best_fit + sizeof(MemoryChunk));
+        return (void *)((uintptr_t)chunk + sizeof(MemoryChunk));
     }
 
     acquire_lock(&manager->class_locks[class_idx]);
+    MemoryChunk *chunk = class_pop_chunk(manager, class_idx);
+    release_lock(&manager->class_locks[class_idx]);
     
-    if (manager->free_lists[class_idx] == 0) {
-        release_lock(&manager->class_locks[class_idx]);
-        
+    if (chunk == 0) {
         // 获取大块锁进行分配
         acquire_lock(&manager->large_lock);
         refill_size_class(manager, class_idx);
         release_lock(&manager->large_lock);
         
-        // 重新获取类别锁
         acquire_lock(&manager->class_locks[class_idx]);
+        chunk = class_pop_chunk(manager, class_idx);
+        release_lock(&manager->class_locks[class_idx]);
         
-        if (manager->free_lists[class_idx] == 0) {
-            release_lock(&manager->class_locks[class_idx]);
+        if (chunk == 0) {
             return 0; // 内存不足
         }
     }
     
-    MemoryChunk *chunk = manager->free_lists[class_idx];
-    manager->free_lists[class_idx] = chunk->next;
-    
     chunk->allocated = 1;
-    
-    release_lock(&manager->class_locks[class_idx]);
-    return (void *)((size_t)chunk + sizeof(MemoryChunk));
+    chunk->owner = MALLOC_NO_OWNER;
+    return (void *)((uintptr_t)chunk + sizeof(MemoryChunk));
 }
 
 
+// 从大块分配器取一页切分成小块，调用者需持有大块锁。
+// 页本身作为一个已分配的大块存在，页描述符和小块都位于它的数据区内
 static void refill_size_class(MemoryManager* manager, size_t class_idx) {
     size_t block_size = size_classes[class_idx];
-    size_t total_size = 4 * 1024; // 一次分配4KB
-    
-    // 从大块内存中分配一块
-    MemoryChunk *big_chunk = 0;
-    MemoryChunk *prev_chunk = 0;
-    for (MemoryChunk *chunk = manager->first; chunk != 0 && big_chunk == 0; chunk = chunk->next) {
-        if (!chunk->allocated && chunk->size >= total_size) {
-            big_chunk = chunk;
-            break;
-        }
-        prev_chunk = chunk;
-    }
     
+    // 页大小取能容纳SIZE_CLASS_MIN_CHUNKS个块的最小整页数
+    size_t page_size = SIZE_CLASS_PAGE_HEADER + SIZE_CLASS_MIN_CHUNKS * (block_size + sizeof(MemoryChunk));
+    page_size = (page_size + SIZE_CLASS_PAGE_SIZE - 1) & ~(SIZE_CLASS_PAGE_SIZE - 1);
+    
+    MemoryChunk *big_chunk = allocate_large(manager, page_size);
     if (big_chunk == 0) {
         kernel_printf("refill_size_class: no big chunk found for class %d\n", class_idx);
         return; // 没有足够的大块内存
     }
     
-    // 从链表中移除大块
-    if (prev_chunk) {
-        prev_chunk->next = big_chunk->next;
-        if (big_chunk->next) {
-            big_chunk->next->prev = prev_chunk;
-        }
-    } else {
-        manager->first = big_chunk->next;
-        if (big_chunk->next) {
-            big_chunk->next->prev = 0;
-        }
-    }
+    SizeClassPage *page = (SizeClassPage *)((uintptr_t)big_chunk + sizeof(MemoryChunk));
+    page->next = 0;
+    page->prev = 0;
+    page->free_chunks = 0;
+    page->in_use = 0;
+    page->class_idx = class_idx;
     
     // 计算可以分割出多少个小块
-    size_t chunk_count = total_size / (block_size + sizeof(MemoryChunk));
-    if (chunk_count == 0) {
-        chunk_count = 1; // 至少一个块
-    }
+    page->total = (big_chunk->size - SIZE_CLASS_PAGE_HEADER) / (block_size + sizeof(MemoryChunk));
     
-    // 分割大块为多个小块并添加到空闲链表
-    char *current_pos = (char *)big_chunk;
-    for (size_t i = 0; i < chunk_count; i++) {
+    // 分割为多个小块，串入页的空闲链表
+    char *current_pos = (char *)page + SIZE_CLASS_PAGE_HEADER;
+    for (size_t i = 0; i < page->total; i++) {
         MemoryChunk *new_chunk = (MemoryChunk *)current_pos;
         new_chunk->size = block_size;
         new_chunk->allocated = 0;
         new_chunk->size_class = class_idx;
-        new_chunk->prev = 0;
-        
-        // 添加到对应类别的空闲链表
-        new_chunk->next = manager->free_lists[class_idx];
-        if (manager->free_lists[class_idx]) {
-            manager->free_lists[class_idx]->prev = new_chunk;
-        }
-        manager->free_lists[class_idx] = new_chunk;
+        new_chunk->owner = MALLOC_NO_OWNER;
+        new_chunk->page = page;
+#ifdef MALLOC_HARDEN
+        poison_chunk(new_chunk);
+#endif
+        new_chunk->next = page->free_chunks;
+        page->free_chunks = new_chunk;
         
         current_pos += sizeof(MemoryChunk) + block_size;
     }
     
-    // 如果有剩余内存，将其添加回大块链表
-    size_t remaining_size = big_chunk->size - total_size;
-    if (remaining_size > sizeof(MemoryChunk) + MIN_ALLOC_SIZE) {
-        MemoryChunk *remaining_chunk = (MemoryChunk *)((char *)big_chunk + total_size);
-        remaining_chunk->size = remaining_size - sizeof(MemoryChunk);
-        remaining_chunk->allocated = 0;
-        remaining_chunk->size_class = NUM_SIZE_CLASSES;
-        remaining_chunk->prev = 0;
-        remaining_chunk->next = manager->first;
+    acquire_lock(&manager->class_locks[class_idx]);
+    page_list_push(&manager->partial_pages[class_idx], page);
+    release_lock(&manager->class_locks[class_idx]);
+}
+
+// 获取当前上下文，首次使用时从共享链表为其分配
+static MallocContext* get_current_context(MemoryManager* manager) {
+    MallocContext* context = manager->contexts[manager->current_context];
+    if (context != 0) {
+        return context;
+    }
+    
+    size_t size = (sizeof(MallocContext) + MIN_ALLOC_SIZE - 1) & ~(MIN_ALLOC_SIZE - 1);
+    context = (MallocContext*)allocate_from_size_class(manager, size, get_size_class_index(size));
+    if (context != 0) {
+        memset(context, 0, sizeof(MallocContext));
+        manager->contexts[manager->current_context] = context;
+    }
+    return context;
+}
+
+// 从类别的页中成批取块装入弹匣，返回弹匣中的块数
+static uint32_t magazine_refill(MemoryManager* manager, Magazine* magazine, size_t class_idx) {
+    acquire_lock(&manager->class_locks[class_idx]);
+    
+    if (manager->partial_pages[class_idx] == 0 && manager->empty_pages[class_idx] == 0) {
+        release_lock(&manager->class_locks[class_idx]);
+        
+        acquire_lock(&manager->large_lock);
+        refill_size_class(manager, class_idx);
+        release_lock(&manager->large_lock);
+        
+        acquire_lock(&manager->class_locks[class_idx]);
+    }
+    
+    while (magazine->count < MAGAZINE_BATCH) {
+        MemoryChunk *chunk = class_pop_chunk(manager, class_idx);
+        if (chunk == 0) {
+            break;
+        }
+        magazine->rounds[magazine->count++] = chunk;
+    }
+    
+    release_lock(&manager->class_locks[class_idx]);
+    return magazine->count;
+}
+
+// 将弹匣中多余的块成批归还所属页，只保留keep个
+static void magazine_flush(MemoryManager* manager, Magazine* magazine, size_t class_idx, uint32_t keep) {
+    SizeClassPage *released = 0;
+    
+    acquire_lock(&manager->class_locks[class_idx]);
+    
+    while (magazine->count > keep) {
+        MemoryChunk *chunk = magazine->rounds[--magazine->count];
+        SizeClassPage *page = class_push_chunk(manager, chunk);
+        if (page) {
+            page->next = released;
+            released = page;
+        }
+    }
+    
+    release_lock(&manager->class_locks[class_idx]);
+    
+    release_class_pages(manager, released);
+}
+
+// 其他上下文释放小块时压入所有者的远程释放链表，不获取类别锁
+static void remote_free_push(MemoryManager* manager, MemoryChunk* chunk) {
+    MemoryChunk* volatile* list = &manager->remote_frees[chunk->owner];
+    MemoryChunk *head;
+    
+    chunk->allocated = 0;
+    do {
+        head = *list;
+        chunk->next = head;
+    } while (!__sync_bool_compare_and_swap(list, head, chunk));
+}
+
+// 所有者整体取走自己的远程释放链表，把块装回弹匣，弹匣满时成批归还所属页
+static void remote_free_drain(MemoryManager* manager, MallocContext* context, uint32_t owner) {
+    MemoryChunk *chunk = __sync_lock_test_and_set(&manager->remote_frees[owner], 0);
+    
+    while (chunk != 0) {
+        MemoryChunk *next = chunk->next;
         
-        if (manager->first) {
-            manager->first->prev = remaining_chunk;
+        if (context == 0) {
+            release_chunk(manager, chunk);
+        } else {
+            Magazine* magazine = &context->magazines[chunk->size_class];
+            if (magazine->count == MAGAZINE_SIZE) {
+                magazine_flush(manager, magazine, chunk->size_class, MAGAZINE_SIZE - MAGAZINE_BATCH);
+            }
+#ifdef MALLOC_HARDEN
+            chunk->next = chunk_canary(chunk);
+#endif
+            magazine->rounds[magazine->count++] = chunk;
         }
-        manager->first = remaining_chunk;
+        chunk = next;
     }
 }
 
+// 小块分配的快速路径：弹匣命中时不获取任何锁
+static void* allocate_from_magazine(MemoryManager* manager, size_t class_idx) {
+    MallocContext* context = get_current_context(manager);
+    if (context == 0) {
+        return allocate_from_size_class(manager, size_classes[class_idx], class_idx);
+    }
+    
+    if (manager->remote_frees[manager->current_context] != 0) {
+        remote_free_drain(manager, context, manager->current_context);
+    }
+    
+    Magazine* magazine = &context->magazines[class_idx];
+    if (magazine->count == 0 && magazine_refill(manager, magazine, class_idx) == 0) {
+        return 0; // 内存不足
+    }
+    
+    MemoryChunk *chunk = magazine->rounds[--magazine->count];
+    chunk->allocated = 1;
+    chunk->owner = manager->current_context;
+    return (void *)((uintptr_t)chunk + sizeof(MemoryChunk));
+}
+
+// 小块释放的快速路径：由其他上下文分配的块交还其所有者，
+// 否则放回当前上下文的弹匣，弹匣满时先成批归还一半
+static int free_to_magazine(MemoryManager* manager, MemoryChunk* chunk) {
+    if (chunk->owner != manager->current_context && chunk->owner < MALLOC_MAX_CONTEXTS &&
+        manager->contexts[chunk->owner] != 0) {
+        remote_free_push(manager, chunk);
+        return 1;
+    }
+    
+    MallocContext* context = manager->contexts[manager->current_context];
+    if (context == 0) {
+        return 0;
+    }
+    
+    Magazine* magazine = &context->magazines[chunk->size_class];
+    if (magazine->count == MAGAZINE_SIZE) {
+        magazine_flush(manager, magazine, chunk->size_class, MAGAZINE_SIZE - MAGAZINE_BATCH);
+    }
+    
+    chunk->allocated = 0;
+    magazine->rounds[magazine->count++] = chunk;
+    return 1;
+}
+
 void on_init_memory_manager(MemoryManager* manager, size_t start, size_t size) {
     activate_memory_manager = manager;
     
-    // 初始化所有空闲链表和锁
+#ifdef MALLOC_HARDEN
+    uint32_t low, high;
+    asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+    heap_canary_secret = (low ^ (high << 16)) & ~(MIN_ALLOC_SIZE - 1);
+#endif
+    
+    // 初始化所有类别的页链表和锁
     for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
-        manager->free_lists[i] = 0;
+        manager->partial_pages[i] = 0;
+        manager->empty_pages[i] = 0;
+        manager->empty_page_count[i] = 0;
         manager->class_locks[i] = 0;
     }
+    manager->page_watermark = SIZE_CLASS_PAGE_WATERMARK;
     manager->large_lock = 0;
+    
+    for (int i = 0; i < MALLOC_MAX_CONTEXTS; i++) {
+        manager->contexts[i] = 0;
+        manager->remote_frees[i] = 0;
+    }
+    manager->current_context = MALLOC_KERNEL_CONTEXT;
 
-    if (size < sizeof(MemoryChunk)) {
+    manager->fl_bitmap = 0;
+    for (int i = 0; i < TLSF_FL_COUNT; i++) {
+        manager->sl_bitmap[i] = 0;
+        for (int j = 0; j < TLSF_SL_COUNT; j++) {
+            manager->blocks[i][j] = 0;
+        }
+    }
+
+    // 堆的起止都对齐到MIN_ALLOC_SIZE，所有块的数据区随之对齐
+    size_t aligned_start = (start + MIN_ALLOC_SIZE - 1) & ~(MIN_ALLOC_SIZE - 1);
+    size = (size > aligned_start - start) ? (size - (aligned_start - start)) & ~(MIN_ALLOC_SIZE - 1) : 0;
+    start = aligned_start;
+    
+    manager->heap_end = start + size;
+    if (size < 2 * sizeof(MemoryChunk) + MIN_ALLOC_SIZE) {
         manager->first = 0;
     } else {
-        manager->first = (MemoryChunk *)start;
+        manager->first = (MemoryChunk *)(uintptr_t)start;
         manager->first->allocated = 0;
-        manager->first->prev = 0;
-        manager->first->next = 0;
-        manager->first->size = size - sizeof(MemoryChunk);
+        manager->first->prev_free = 0;
+        manager->first->size = size - 2 * sizeof(MemoryChunk);
         manager->first->size_class = NUM_SIZE_CLASSES; // 标记为大块
+        
+        // 堆尾放一个大小为0的已分配哨兵块，合并时无需检查边界
+        MemoryChunk *sentinel = next_physical_chunk(manager->first);
+        sentinel->allocated = 1;
+        sentinel->prev_free = 1;
+        sentinel->size = 0;
+        sentinel->size_class = NUM_SIZE_CLASSES;
+        sentinel->prev = 0;
+        sentinel->next = 0;
+        
+        set_footer(manager->first);
+        tlsf_insert_block(manager, manager->first);
     }
 
     kernel_printf("init memory manager success!\nthe first memory chunk address:%x\n", manager->first);
 }
 
+// 按物理地址顺序遍历所有大块，调用者需持有大块锁
+static void collect_heap_stats(MemoryManager* manager, HeapStats* stats) {
+    memset(stats, 0, sizeof(HeapStats));
+    if (manager->first == 0) {
+        return;
+    }
+    
+    for (MemoryChunk *chunk = manager->first; chunk->size != 0; chunk = next_physical_chunk(chunk)) {
+        stats->chunk_count++;
+        if (!chunk->allocated) {
+            stats->free_count++;
+            stats->free_bytes += chunk->size;
+            if (chunk->size > stats->largest_free) {
+                stats->largest_free = chunk->size;
+            }
+        }
+    }
+    
+    // 避免32位乘法溢出，先把空闲总量缩小为百分之一
+    if (stats->free_bytes > 0) {
+        size_t unit = (stats->free_bytes + 99) / 100;
+        uint32_t largest_percent = stats->largest_free / unit;
+        stats->fragmentation = largest_percent >= 100 ? 0 : 100 - largest_percent;
+    }
+}
+
+void malloc_get_heap_stats(HeapStats* stats) {
+    if (stats == 0) {
+        return;
+    }
+    if (activate_memory_manager == 0) {
+        memset(stats, 0, sizeof(HeapStats));
+        return;
+    }
+    
+    uint32_t flags = local_irq_save();
+    acquire_lock(&activate_memory_manager->large_lock);
+    collect_heap_stats(activate_memory_manager, stats);
+    release_lock(&activate_memory_manager->large_lock);
+    local_irq_restore(flags);
+}
+
 void print_memory_status() {
     if (activate_memory_manager == 0) {
         kernel_printf("Memory manager not initialized\n");
@@ -223,38 +750,78 @@ void print_memory_status() {
     acquire_lock(&activate_memory_manager->large_lock);
     
     kernel_printf("Memory status:\n");
-    kernel_printf("Large blocks:\n");
+    kernel_printf("Large free bins:\n");
     
     int large_count = 0;
     size_t large_free = 0;
-    for (MemoryChunk *chunk = activate_memory_manager->first; chunk != 0; chunk = chunk->next) {
-        kernel_printf("  Chunk at %x: size=%d, allocated=%d\n", 
-                     chunk, chunk->size, chunk->allocated);
-        large_count++;
-        if (!chunk->allocated) {
-            large_free += chunk->size;
+    for (uint32_t fl = 0; fl < TLSF_FL_COUNT; fl++) {
+        if (!(activate_memory_manager->fl_bitmap & (1U << fl))) {
+            continue;
+        }
+        for (uint32_t sl = 0; sl < TLSF_SL_COUNT; sl++) {
+            int count = 0;
+            size_t bytes = 0;
+            for (MemoryChunk *chunk = activate_memory_manager->blocks[fl][sl]; chunk != 0; chunk = chunk->next) {
+                count++;
+                bytes += chunk->size;
+            }
+            if (count > 0) {
+                kernel_printf("  Bin [%d][%d]: %d free blocks, %d bytes\n", fl, sl, count, bytes);
+            }
+            large_count += count;
+            large_free += bytes;
         }
     }
     
-    kernel_printf("Total large blocks: %d, free memory: %d bytes\n", large_count, large_free);
+    kernel_printf("Total free large blocks: %d, free memory: %d bytes\n", large_count, large_free);
+    
+    HeapStats stats;
+    collect_heap_stats(activate_memory_manager, &stats);
+    kernel_printf("Heap layout: %d chunks, %d free, largest free %d bytes, fragmentation %d%%\n",
+                 stats.chunk_count, stats.free_count, stats.largest_free, stats.fragmentation);
     
     // 释放大块锁
     release_lock(&activate_memory_manager->large_lock);
     
-    kernel_printf("Size class free lists:\n");
+    kernel_printf("Size class pages:\n");
     for (int i = 0; i < NUM_SIZE_CLASSES; i++) {
         // 获取每个类别的锁
         acquire_lock(&activate_memory_manager->class_locks[i]);
         
-        int count = 0;
-        for (MemoryChunk *chunk = activate_memory_manager->free_lists[i]; chunk != 0; chunk = chunk->next) {
-            count++;
+        int pages = 0;
+        int free_blocks = 0;
+        for (SizeClassPage *page = activate_memory_manager->partial_pages[i]; page != 0; page = page->next) {
+            pages++;
+            free_blocks += page->total - page->in_use;
+        }
+        for (SizeClassPage *page = activate_memory_manager->empty_pages[i]; page != 0; page = page->next) {
+            pages++;
+            free_blocks += page->total;
         }
-        kernel_printf("  Class %d (%d bytes): %d free blocks\n", i, size_classes[i], count);
+        kernel_printf("  Class %d (%d bytes): %d partial/empty pages (%d empty), %d free blocks\n",
+                     i, size_classes[i], pages, activate_memory_manager->empty_page_count[i], free_blocks);
         
         // 释放类别锁
         release_lock(&activate_memory_manager->class_locks[i]);
     }
+    
+    kernel_printf("Magazines:\n");
+    for (int i = 0; i < MALLOC_MAX_CONTEXTS; i++) {
+        MallocContext* context = activate_memory_manager->contexts[i];
+        if (context == 0) {
+            continue;
+        }
+        
+        int cached = 0;
+        for (int j = 0; j < NUM_SIZE_CLASSES; j++) {
+            cached += context->magazines[j].count;
+        }
+        int remote = 0;
+        for (MemoryChunk *chunk = activate_memory_manager->remote_frees[i]; chunk != 0; chunk = chunk->next) {
+            remote++;
+        }
+        kernel_printf("  Context %d: %d cached blocks, %d remote frees pending\n", i, cached, remote);
+    }
 }
 
 void *malloc(size_t size) {
@@ -268,64 +835,326 @@ void *malloc(size_t size) {
     // 获取大小类别索引
     size_t class_idx = get_size_class_index(size);
     
-    // 从对应类别分配内存
-    void* result = allocate_from_size_class(activate_memory_manager, size, class_idx);
+    uint32_t flags = local_irq_save();
+    
+    // 小块走当前上下文的弹匣，大块直接从大块链表分配
+    void* result;
+    if (class_idx < NUM_SIZE_CLASSES) {
+        result = allocate_from_magazine(activate_memory_manager, class_idx);
+    } else {
+        result = allocate_from_size_class(activate_memory_manager, size, class_idx);
+    }
+    
+    local_irq_restore(flags);
     
     if (result == 0) {
         kernel_printf("malloc: allocation failed for size %d\n", size);
         // 打印内存状态用于调试
         print_memory_status();
     }
+#ifdef MALLOC_HARDEN
+    else if (class_idx >= NUM_SIZE_CLASSES) {
+        harden_on_alloc(result);
+    }
+#endif
+#ifdef MALLOC_PROFILE
+    malloc_profile_record(result, size, class_idx, (uint32_t)(uintptr_t)__builtin_return_address(0));
+#endif
     return result;
 }
 
+// 将块直接归还到共享空闲链表或大块链表
+static void release_chunk(MemoryManager* manager, MemoryChunk* chunk) {
+    // 如果是小块分配，获取对应类别的锁放回所属页
+    if (chunk->size_class < NUM_SIZE_CLASSES) {
+        acquire_lock(&manager->class_locks[chunk->size_class]);
+        SizeClassPage *released = class_push_chunk(manager, chunk);
+        release_lock(&manager->class_locks[chunk->size_class]);
+        
+        if (released) {
+            released->next = 0;
+            release_class_pages(manager, released);
+        }
+        return;
+    }
+    
+    // 大块分配，获取大块锁
+    acquire_lock(&manager->large_lock);
+    free_large(manager, chunk);
+    release_lock(&manager->large_lock);
+}
+
 void free(void *ptr) {
     if (activate_memory_manager == 0 || ptr == 0) {
         return;
     }
     
-    MemoryChunk *chunk = (MemoryChunk *)((size_t)ptr - sizeof(MemoryChunk));
+    MemoryChunk *chunk = (MemoryChunk *)((uintptr_t)ptr - sizeof(MemoryChunk));
     
-    // 如果是小块分配，获取对应类别的锁
-    if (chunk->size_class < NUM_SIZE_CLASSES) {
-        acquire_lock(&activate_memory_manager->class_locks[chunk->size_class]);
+#ifdef MALLOC_PROFILE
+    malloc_profile_forget(ptr);
+#endif
+    
+    uint32_t flags = local_irq_save();
+    
+#ifdef MALLOC_HARDEN
+    if (!harden_check_chunk(activate_memory_manager, ptr, (uint32_t)(uintptr_t)__builtin_return_address(0))) {
+        local_irq_restore(flags);
+        return;
+    }
+#endif
+    
+    // 小块优先放回当前上下文的弹匣
+    if (chunk->size_class >= NUM_SIZE_CLASSES || !free_to_magazine(activate_memory_manager, chunk)) {
+        release_chunk(activate_memory_manager, chunk);
+    }
+    
+    local_irq_restore(flags);
+}
+
+// 原地调整大块的大小，成功返回1。扩展时吞并物理上紧随其后的空闲块，
+// 缩小或吞并后多出的部分（如果够大）切成独立的块放回空闲链表，调用者需持有大块锁
+static int resize_large_in_place(MemoryManager* manager, MemoryChunk* chunk, size_t size) {
+    if (size > chunk->size) {
+        MemoryChunk *next = next_physical_chunk(chunk);
+        if (next->allocated || chunk->size + sizeof(MemoryChunk) + next->size < size) {
+            return 0;
+        }
         
-        chunk->allocated = 0;
-        chunk->next = activate_memory_manager->free_lists[chunk->size_class];
-        if (chunk->next) {
-            chunk->next->prev = chunk;
+        tlsf_remove_block(manager, next);
+        chunk->size += sizeof(MemoryChunk) + next->size;
+        use_free_block(manager, chunk, size);
+#ifdef MALLOC_HARDEN
+        chunk->next = chunk_canary(chunk);
+#endif
+        return 1;
+    }
+    
+    if (chunk->size >= size + sizeof(MemoryChunk) + MIN_ALLOC_SIZE) {
+        // 把尾部作为一个已分配的块释放，由free_large负责与后继合并
+        MemoryChunk *tail = (MemoryChunk *)((uintptr_t)chunk + sizeof(MemoryChunk) + size);
+        tail->size = chunk->size - size - sizeof(MemoryChunk);
+        tail->allocated = 1;
+        tail->prev_free = 0;
+        tail->size_class = NUM_SIZE_CLASSES;
+        chunk->size = size;
+#ifdef MALLOC_HARDEN
+        chunk->next = chunk_canary(chunk);
+        tail->next = chunk_canary(tail);
+#endif
+        free_large(manager, tail);
+    }
+    return 1;
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (ptr == 0) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return 0;
+    }
+    if (activate_memory_manager == 0 || size >= TLSF_MAX_ALLOC) {
+        return 0;
+    }
+    
+    MemoryChunk *chunk = (MemoryChunk *)((uintptr_t)ptr - sizeof(MemoryChunk));
+    size_t aligned_size = (size + MIN_ALLOC_SIZE - 1) & ~(MIN_ALLOC_SIZE - 1);
+    
+#ifdef MALLOC_HARDEN
+    if (!harden_check_chunk(activate_memory_manager, ptr, (uint32_t)(uintptr_t)__builtin_return_address(0))) {
+        return 0;
+    }
+#endif
+    
+    // 小块在所属类别内放得下就不动；仍属小块范围的大块不缩小，避免产生过小的空闲块
+    if (chunk->size_class < NUM_SIZE_CLASSES) {
+        if (aligned_size <= chunk->size) {
+            return ptr;
         }
-        activate_memory_manager->free_lists[chunk->size_class] = chunk;
+    } else if (aligned_size > SIZE_CLASS_MAX || aligned_size > chunk->size) {
+        uint32_t flags = local_irq_save();
+        acquire_lock(&activate_memory_manager->large_lock);
+        int resized = resize_large_in_place(activate_memory_manager, chunk, aligned_size);
+        release_lock(&activate_memory_manager->large_lock);
+        local_irq_restore(flags);
         
-        release_lock(&activate_memory_manager->class_locks[chunk->size_class]);
-        return;
+        if (resized) {
+#ifdef MALLOC_PROFILE
+            malloc_profile_forget(ptr);
+            malloc_profile_record(ptr, aligned_size, NUM_SIZE_CLASSES, (uint32_t)(uintptr_t)__builtin_return_address(0));
+#endif
+            return ptr;
+        }
+    } else {
+        return ptr;
     }
     
-    // 大块分配，获取大块锁
-    acquire_lock(&activate_memory_manager->large_lock);
+    // 无法原地调整，分配新块并复制
+    void *result = malloc(size);
+    if (result == 0) {
+        return 0;
+    }
+    memcpy(result, ptr, chunk->size < size ? chunk->size : size);
+    free(ptr);
+    return result;
+}
+
+// 堆中的内存会被反复使用，新切分的页和新取的大块都可能残留旧数据，因此总要清零；
+// 只清请求的字节数，而不是取整后的整块
+void* calloc(size_t count, size_t size) {
+    if (size != 0 && count > (TLSF_MAX_ALLOC - 1) / size) {
+        kernel_printf("calloc: %d * %d overflows\n", count, size);
+        return 0;
+    }
     
-    chunk->allocated = 0;
+    void *result = malloc(count * size);
+    if (result != 0) {
+        memset(result, 0, count * size);
+    }
+    return result;
+}
 
-    // 向前合并所有空闲块
-    while (chunk->prev != 0 && !chunk->prev->allocated) {
-        MemoryChunk *prev = chunk->prev;
-        prev->next = chunk->next;
-        prev->size += chunk->size + sizeof(MemoryChunk);
-        if (chunk->next != 0) {
-            chunk->next->prev = prev;
+// 切换当前分配上下文
+void malloc_switch_context(uint32_t context) {
+    if (activate_memory_manager == 0) {
+        return;
+    }
+    
+    if (context >= MALLOC_MAX_CONTEXTS) {
+        context = MALLOC_KERNEL_CONTEXT;
+    }
+    activate_memory_manager->current_context = context;
+}
+
+// 回收一个上下文：清空它的所有弹匣并释放上下文本身
+void malloc_release_context(uint32_t context) {
+    if (activate_memory_manager == 0 || context >= MALLOC_MAX_CONTEXTS) {
+        return;
+    }
+    
+    uint32_t flags = local_irq_save();
+    
+    MallocContext* released = activate_memory_manager->contexts[context];
+    activate_memory_manager->contexts[context] = 0;
+    
+    // 上下文已不存在，此后其他上下文释放它分配的块会直接归还所属页
+    remote_free_drain(activate_memory_manager, released, context);
+    
+    if (released) {
+        for (size_t i = 0; i < NUM_SIZE_CLASSES; i++) {
+            magazine_flush(activate_memory_manager, &released->magazines[i], i, 0);
         }
-        chunk = prev;
+        release_chunk(activate_memory_manager, (MemoryChunk *)((uintptr_t)released - sizeof(MemoryChunk)));
     }
+    
+    local_irq_restore(flags);
+}
 
-    // 向后合并所有空闲块
-    while (chunk->next != 0 && !chunk->next->allocated) {
-        MemoryChunk *next = chunk->next;
-        chunk->next = next->next;
-        chunk->size += next->size + sizeof(MemoryChunk);
-        if (next->next != 0) {
-            next->next->prev = chunk;
+// 设置每个类别保留的空闲页数，并立即归还超出的空闲页
+void malloc_set_page_watermark(uint32_t pages) {
+    if (activate_memory_manager == 0) {
+        return;
+    }
+    
+    uint32_t flags = local_irq_save();
+    
+    activate_memory_manager->page_watermark = pages;
+    for (size_t i = 0; i < NUM_SIZE_CLASSES; i++) {
+        SizeClassPage *released = 0;
+        
+        acquire_lock(&activate_memory_manager->class_locks[i]);
+        while (activate_memory_manager->empty_page_count[i] > pages) {
+            SizeClassPage *page = activate_memory_manager->empty_pages[i];
+            page_list_remove(&activate_memory_manager->empty_pages[i], page);
+            activate_memory_manager->empty_page_count[i]--;
+            page->next = released;
+            released = page;
         }
+        release_lock(&activate_memory_manager->class_locks[i]);
+        
+        release_class_pages(activate_memory_manager, released);
     }
+    
+    local_irq_restore(flags);
+}
 
+static void* allocate_aligned(size_t size, size_t align) {
+    if (activate_memory_manager == 0) {
+        return 0;
+    }
+    
+    if (align == 0 || (align & (align - 1)) != 0) {
+        kernel_printf("allocate_aligned: alignment %d is not a power of two\n", align);
+        return 0;
+    }
+    
+    size = (size + MIN_ALLOC_SIZE - 1) & ~(MIN_ALLOC_SIZE - 1);
+    if (size == 0) {
+        size = MIN_ALLOC_SIZE;
+    }
+    
+    // 对齐的块总是作为大块分配，free时按大块归还并合并
+    uint32_t flags = local_irq_save();
+    acquire_lock(&activate_memory_manager->large_lock);
+    MemoryChunk *chunk = allocate_large_aligned(activate_memory_manager, size, align);
     release_lock(&activate_memory_manager->large_lock);
+    local_irq_restore(flags);
+    
+    if (chunk == 0) {
+        kernel_printf("allocate_aligned: allocation failed for size %d, align %d\n", size, align);
+        return 0;
+    }
+#ifdef MALLOC_HARDEN
+    chunk->next = chunk_canary(chunk);
+#endif
+    return (void *)((uintptr_t)chunk + sizeof(MemoryChunk));
+}
+
+void* kmalloc_aligned(size_t size, size_t align) {
+    void* result = allocate_aligned(size, align);
+#ifdef MALLOC_PROFILE
+    malloc_profile_record(result, size, NUM_SIZE_CLASSES, (uint32_t)(uintptr_t)__builtin_return_address(0));
+#endif
+    return result;
+}
+
+// 判断地址是否位于堆内
+static int heap_contains(MemoryManager* manager, size_t address) {
+    return manager->first != 0 && address >= (uintptr_t)manager->first && address < manager->heap_end;
+}
+
+void* kmalloc_pages(size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    
+    // 优先由伙伴分配器提供物理连续的页，多页时按2的幂取整；不可用时从堆中分配
+    if (count <= (1U << PFM_MAX_ORDER) && pfm_get_free_frames_count() >= count) {
+        uint32_t frame = pfm_allocate_frames(pfm_order_for_count(count));
+        if (frame) {
+            return (void *)(uintptr_t)frame;
+        }
+    }
+    
+    void* result = allocate_aligned(count * PAGE_SIZE, PAGE_SIZE);
+#ifdef MALLOC_PROFILE
+    malloc_profile_record(result, count * PAGE_SIZE, NUM_SIZE_CLASSES, (uint32_t)(uintptr_t)__builtin_return_address(0));
+#endif
+    return result;
+}
+
+void kfree_pages(void* pages, size_t count) {
+    if (pages == 0 || count == 0) {
+        return;
+    }
+    
+    // 按地址区分来源：堆内的页归还堆，其余归还页面框管理器（两者管理的内存不得重叠）
+    if (activate_memory_manager != 0 && heap_contains(activate_memory_manager, (uintptr_t)pages)) {
+        free(pages);
+        return;
+    }
+    
+    pfm_free_frames((uint32_t)(uintptr_t)pages, pfm_order_for_count(count));
 }
\ No newline at end of file
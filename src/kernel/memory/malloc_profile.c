@@ -0,0 +1,240 @@
+#include <kernel/memory/malloc_profile.h>
+#include <kernel/memory/malloc.h>
+#include <kernel/kerio.h>
+#include <kernel/string.h>
+#include <kernel/sync.h>
+
+#ifdef MALLOC_PROFILE
+
+// 以地址为键的开放寻址表，线性探测，删除时回移后续元素而不留墓碑
+static AllocRecord records[MALLOC_PROFILE_RECORDS];
+static uint32_t record_count = 0;
+static uint32_t dropped_count = 0;      // 表满时未能记录的分配数
+static uint32_t current_checkpoint = 0;
+static uint32_t profile_lock = 0;
+
+static inline uint32_t profile_timestamp() {
+    uint32_t low, high;
+    asm volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return (high << 16) | (low >> 16);
+}
+
+static inline uint32_t record_home(uint32_t address) {
+    return ((address >> 4) * 2654435761U) >> (32 - MALLOC_PROFILE_RECORDS_LOG2);
+}
+
+void malloc_profile_record(void* address, size_t size, uint8_t size_class, uint32_t caller) {
+    if (address == 0) {
+        return;
+    }
+
+    uint32_t flags = local_irq_save();
+    acquire_lock(&profile_lock);
+
+    // 保留一个空槽，保证探测总能终止
+    if (record_count >= MALLOC_PROFILE_RECORDS - 1) {
+        dropped_count++;
+    } else {
+        uint32_t i = record_home((uint32_t)(uintptr_t)address);
+        while (records[i].address != 0) {
+            i = (i + 1) & (MALLOC_PROFILE_RECORDS - 1);
+        }
+
+        records[i].address = (uint32_t)(uintptr_t)address;
+        records[i].caller = caller;
+        records[i].size = size;
+        records[i].timestamp = profile_timestamp();
+        records[i].checkpoint = current_checkpoint;
+        records[i].size_class = size_class;
+        record_count++;
+    }
+
+    release_lock(&profile_lock);
+    local_irq_restore(flags);
+}
+
+void malloc_profile_forget(void* address) {
+    if (address == 0) {
+        return;
+    }
+
+    uint32_t flags = local_irq_save();
+    acquire_lock(&profile_lock);
+
+    uint32_t i = record_home((uint32_t)(uintptr_t)address);
+    while (records[i].address != 0 && records[i].address != (uint32_t)(uintptr_t)address) {
+        i = (i + 1) & (MALLOC_PROFILE_RECORDS - 1);
+    }
+
+    // 未被记录的地址（表满时分配的）直接忽略
+    if (records[i].address != 0) {
+        // 把探测链上可以前移的元素移入空出的槽
+        uint32_t j = i;
+        for (;;) {
+            j = (j + 1) & (MALLOC_PROFILE_RECORDS - 1);
+            if (records[j].address == 0) {
+                break;
+            }
+            uint32_t home = record_home(records[j].address);
+            // home不在(i, j]的循环区间内时，j上的元素可以移到i
+            uint32_t movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+            if (movable) {
+                records[i] = records[j];
+                i = j;
+            }
+        }
+        records[i].address = 0;
+        record_count--;
+    }
+
+    release_lock(&profile_lock);
+    local_irq_restore(flags);
+}
+
+uint32_t malloc_profile_checkpoint() {
+    uint32_t flags = local_irq_save();
+    acquire_lock(&profile_lock);
+    uint32_t checkpoint = ++current_checkpoint;
+    release_lock(&profile_lock);
+    local_irq_restore(flags);
+
+    kernel_printf("Heap checkpoint %d (%d outstanding allocations)\n", checkpoint, record_count);
+    return checkpoint;
+}
+
+// 按调用者聚合当前记录，返回分配点数；超出上限的计入other
+static uint32_t collect_sites(AllocSite* sites, AllocSite* other) {
+    uint32_t site_count = 0;
+    memset(other, 0, sizeof(AllocSite));
+
+    for (uint32_t i = 0; i < MALLOC_PROFILE_RECORDS; i++) {
+        if (records[i].address == 0) {
+            continue;
+        }
+
+        uint32_t s = 0;
+        while (s < site_count && sites[s].caller != records[i].caller) {
+            s++;
+        }
+
+        AllocSite* site;
+        if (s < site_count) {
+            site = &sites[s];
+        } else if (site_count < MALLOC_PROFILE_SITES) {
+            site = &sites[site_count++];
+            site->caller = records[i].caller;
+            site->count = 0;
+            site->bytes = 0;
+        } else {
+            site = other;
+        }
+        site->count++;
+        site->bytes += records[i].size;
+    }
+    return site_count;
+}
+
+// 按bytes（by_bytes非零）或count把前count个分配点排到数组前部
+static void print_sites_sorted(AllocSite* sites, uint32_t site_count, uint32_t count, int by_bytes) {
+    for (uint32_t i = 0; i < site_count && i < count; i++) {
+        uint32_t best = i;
+        for (uint32_t j = i + 1; j < site_count; j++) {
+            uint32_t key_j = by_bytes ? sites[j].bytes : sites[j].count;
+            uint32_t key_best = by_bytes ? sites[best].bytes : sites[best].count;
+            if (key_j > key_best) {
+                best = j;
+            }
+        }
+        AllocSite tmp = sites[i];
+        sites[i] = sites[best];
+        sites[best] = tmp;
+
+        kernel_printf("  %x: %d bytes in %d allocations\n", sites[i].caller, sites[i].bytes, sites[i].count);
+    }
+}
+
+void malloc_profile_print_top(uint32_t count) {
+    static AllocSite sites[MALLOC_PROFILE_SITES];
+    AllocSite other;
+
+    uint32_t flags = local_irq_save();
+    acquire_lock(&profile_lock);
+
+    uint32_t site_count = collect_sites(sites, &other);
+
+    kernel_printf("Outstanding heap allocations: %d tracked, %d dropped (table full)\n", record_count, dropped_count);
+    kernel_printf("Top allocation sites by bytes:\n");
+    print_sites_sorted(sites, site_count, count, 1);
+    kernel_printf("Top allocation sites by count:\n");
+    print_sites_sorted(sites, site_count, count, 0);
+    if (other.count > 0) {
+        kernel_printf("  other sites: %d bytes in %d allocations\n", other.bytes, other.count);
+    }
+
+    release_lock(&profile_lock);
+    local_irq_restore(flags);
+}
+
+void malloc_profile_print_outstanding(uint32_t from, uint32_t to) {
+    uint32_t flags = local_irq_save();
+    acquire_lock(&profile_lock);
+
+    if (to > current_checkpoint) {
+        kernel_printf("Allocations made since checkpoint %d still outstanding:\n", from);
+    } else {
+        kernel_printf("Allocations made between checkpoints %d and %d still outstanding:\n", from, to);
+    }
+
+    uint32_t listed = 0;
+    uint32_t matched = 0;
+    uint32_t bytes = 0;
+    for (uint32_t i = 0; i < MALLOC_PROFILE_RECORDS; i++) {
+        AllocRecord* record = &records[i];
+        if (record->address == 0 || record->checkpoint < from || record->checkpoint >= to) {
+            continue;
+        }
+
+        matched++;
+        bytes += record->size;
+        if (listed < MALLOC_PROFILE_MAX_LISTED) {
+            kernel_printf("  %x: %d bytes, class %d, caller %x, time %x\n",
+                         record->address, record->size, record->size_class, record->caller, record->timestamp);
+            listed++;
+        }
+    }
+
+    if (matched > listed) {
+        kernel_printf("  ... and %d more\n", matched - listed);
+    }
+    kernel_printf("Total: %d allocations, %d bytes\n", matched, bytes);
+
+    release_lock(&profile_lock);
+    local_irq_restore(flags);
+}
+
+#else
+
+static void profile_disabled() {
+    kernel_printf("Heap profiling is disabled, rebuild with MALLOC_PROFILE=1\n");
+}
+
+void malloc_profile_record(void* address, size_t size, uint8_t size_class, uint32_t caller) {
+}
+
+void malloc_profile_forget(void* address) {
+}
+
+uint32_t malloc_profile_checkpoint() {
+    profile_disabled();
+    return 0;
+}
+
+void malloc_profile_print_top(uint32_t count) {
+    profile_disabled();
+}
+
+void malloc_profile_print_outstanding(uint32_t from, uint32_t to) {
+    profile_disabled();
+}
+
+#endif
@@ -0,0 +1,166 @@
+#include <kernel/memory/page_cache.h>
+#include <kernel/memory/paging.h>
+#include <kernel/memory/slab.h>
+#include <kernel/kerio.h>
+#include <kernel/string.h>
+
+// 被映射的文件组成的链表
+static PageCacheFile* cached_files = NULL;
+static CachedPage* page_hash[PAGE_CACHE_BUCKETS];
+
+static KmemCache* cached_file_cache = NULL;
+static KmemCache* cached_page_cache = NULL;
+
+static inline uint32_t page_hash_index(PageCacheFile* file, uint32_t index) {
+    return (((uint32_t)file >> 4) ^ (index * 2654435761U)) % PAGE_CACHE_BUCKETS;
+}
+
+static CachedPage* page_cache_lookup(PageCacheFile* file, uint32_t index) {
+    CachedPage* page = page_hash[page_hash_index(file, index)];
+    while (page && (page->file != file || page->index != index)) {
+        page = page->hash_next;
+    }
+    return page;
+}
+
+// 把页面写回文件。文件大小以读入时底层文件实际返回的字节数为准，
+// 不依赖各文件系统是否填写Inode.size
+static void page_cache_write_page(CachedPage* page) {
+    PageCacheFile* file = page->file;
+    uint32_t offset = page->index * PAGE_SIZE;
+    uint32_t length = page->length;
+    page->dirty = 0;
+    if (!file->ops.write || length == 0) {
+        return;
+    }
+
+    if (file->ops.write(file->inode, (const void*)page->frame, length, offset) != length) {
+        kernel_printf("page cache: write back failed, inode %d page %d\n", file->inode_num, page->index);
+    }
+}
+
+PageCacheFile* page_cache_get_file(Inode* inode) {
+    FileOperations* ops = inode ? (FileOperations*)inode->private_data : NULL;
+    if (!ops || !ops->read) {
+        return NULL;
+    }
+
+    for (PageCacheFile* file = cached_files; file; file = file->next) {
+        if (file->ops.read == ops->read && file->inode_num == inode->inode_num) {
+            file->ref_count++;
+            return file;
+        }
+    }
+
+    if (!cached_file_cache) {
+        cached_file_cache = kmem_cache_create("page_cache_file", sizeof(PageCacheFile), 0, NULL);
+        cached_page_cache = kmem_cache_create("cached_page", sizeof(CachedPage), 0, NULL);
+    }
+    PageCacheFile* file = (PageCacheFile*)kmem_cache_alloc(cached_file_cache);
+    if (!file) {
+        return NULL;
+    }
+
+    file->ops = *ops;
+    file->inode_num = inode->inode_num;
+    file->inode = inode;
+    file->ref_count = 1;
+    file->page_count = 0;
+    file->pages = NULL;
+    file->next = cached_files;
+    cached_files = file;
+
+    // 文件描述符关闭后映射仍然有效
+    inode->ref_count++;
+    return file;
+}
+
+void page_cache_hold_file(PageCacheFile* file) {
+    file->ref_count++;
+}
+
+void page_cache_put_file(PageCacheFile* file) {
+    if (!file || --file->ref_count > 0) {
+        return;
+    }
+
+    page_cache_sync(file);
+
+    while (file->pages) {
+        CachedPage* page = file->pages;
+        file->pages = page->file_next;
+
+        CachedPage** link = &page_hash[page_hash_index(file, page->index)];
+        while (*link != page) {
+            link = &(*link)->hash_next;
+        }
+        *link = page->hash_next;
+
+        // 仍被写时复制映射引用的页面框在那些映射解除时才归还
+        pfm_free_frame(page->frame);
+        kmem_cache_free(cached_page_cache, page);
+    }
+
+    PageCacheFile** link = &cached_files;
+    while (*link != file) {
+        link = &(*link)->next;
+    }
+    *link = file->next;
+
+    vfs_destroy_inode(file->inode);
+    kmem_cache_free(cached_file_cache, file);
+}
+
+uint32_t page_cache_get_page(PageCacheFile* file, uint32_t index) {
+    CachedPage* page = page_cache_lookup(file, index);
+    if (page) {
+        return page->frame;
+    }
+
+    page = (CachedPage*)kmem_cache_alloc(cached_page_cache);
+    if (!page) {
+        return 0;
+    }
+    uint32_t frame = pfm_allocate_frame();
+    if (!frame) {
+        kmem_cache_free(cached_page_cache, page);
+        return 0;
+    }
+
+    // 文件末尾之后的部分填0
+    size_t bytes = file->ops.read(file->inode, (void*)frame, PAGE_SIZE, index * PAGE_SIZE);
+    if (bytes > PAGE_SIZE) {
+        bytes = 0;
+    }
+    memset((uint8_t*)frame + bytes, 0, PAGE_SIZE - bytes);
+
+    page->file = file;
+    page->index = index;
+    page->frame = frame;
+    page->length = bytes;
+    page->dirty = 0;
+
+    uint32_t bucket = page_hash_index(file, index);
+    page->hash_next = page_hash[bucket];
+    page_hash[bucket] = page;
+    page->file_next = file->pages;
+    file->pages = page;
+    file->page_count++;
+
+    return frame;
+}
+
+void page_cache_mark_dirty(PageCacheFile* file, uint32_t index) {
+    CachedPage* page = page_cache_lookup(file, index);
+    if (page) {
+        page->dirty = 1;
+    }
+}
+
+void page_cache_sync(PageCacheFile* file) {
+    for (CachedPage* page = file->pages; page; page = page->file_next) {
+        if (page->dirty) {
+            page_cache_write_page(page);
+        }
+    }
+}
@@ -2,7 +2,10 @@
 #include "stdtype.h"
 #include "kernel/kerio.h"
 #include "kernel/memory/malloc.h"
+#include "kernel/memory/slab.h"
+#include "kernel/memory/page_cache.h"
 #include "kernel/string.h"
+#include "kernel/sync.h"
 #include "kernel/interrupt/interrupt.h"
 #include "kernel/gdt.h"
 #include "kernel/multitask/process.h"
@@ -13,6 +16,9 @@ extern ProcessManager* process_manager;
 // 全局虚拟内存管理器
 VirtualMemoryManager* vmm = NULL;
 
+// 内存区域的对象缓存，首次创建区域时建立
+static KmemCache* memory_region_cache = NULL;
+
 // 内联汇编函数，用于操作CR0和CR3寄存器
 static inline void set_cr3(uint32_t page_directory_physical_address) {
     asm volatile ("mov %0, %%cr3" : : "r"(page_directory_physical_address));
@@ -34,63 +40,410 @@ static inline uint32_t get_cr0() {
     return cr0;
 }
 
-// 初始化页面框管理器
-void pfm_init(PageFrameManager* manager, uint32_t start_address, uint32_t size) {
-    // 确保start_address是页对齐的
-    start_address = (start_address + PAGE_SIZE - 1) & PAGE_MASK;
-    
-    // 计算页面框数量
+static inline void set_cr4(uint32_t cr4) {
+    asm volatile ("mov %0, %%cr4" : : "r"(cr4));
+}
+
+static inline uint32_t get_cr4() {
+    uint32_t cr4;
+    asm volatile ("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+#define CR4_PSE 0x10                        // 允许页目录项映射4MB大页
+#define CR4_PGE 0x80                        // 允许全局页，重载CR3时不刷新其TLB项
+#define CPUID_FEATURE_PSE (1 << 3)          // CPUID 1号功能EDX中的PSE位
+#define CPUID_FEATURE_PGE (1 << 13)         // CPUID 1号功能EDX中的PGE位
+
+// CPUID 1号功能的EDX
+static inline uint32_t cpuid_features() {
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    asm volatile ("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return edx;
+}
+
+// 下标为index的页面框的物理地址
+static inline uint32_t pfm_frame_address(PageFrameManager* manager, uint32_t index) {
+    return (manager->base_frame + index) * PAGE_SIZE;
+}
+
+static inline FreeFrameLink* frame_link(PageFrameManager* manager, uint32_t index) {
+    return (FreeFrameLink*)pfm_frame_address(manager, index);
+}
+
+// 把以index为首页的order阶块插入空闲链表
+static void buddy_push(PageFrameManager* manager, uint32_t index, uint32_t order) {
+    PageFrame* frame = &manager->frames[index];
+    FreeFrameLink* link = frame_link(manager, index);
+    frame->flags = PAGE_FRAME_FREE_BLOCK;
+    frame->order = order;
+    link->prev = PFM_NO_FRAME;
+    link->next = manager->free_lists[order];
+    if (link->next != PFM_NO_FRAME) {
+        frame_link(manager, link->next)->prev = index;
+    }
+    manager->free_lists[order] = index;
+    manager->free_blocks[order]++;
+    manager->order_bitmap |= 1U << order;
+}
+
+static void buddy_remove(PageFrameManager* manager, uint32_t index, uint32_t order) {
+    PageFrame* frame = &manager->frames[index];
+    FreeFrameLink* link = frame_link(manager, index);
+    if (link->prev != PFM_NO_FRAME) {
+        frame_link(manager, link->prev)->next = link->next;
+    } else {
+        manager->free_lists[order] = link->next;
+    }
+    if (link->next != PFM_NO_FRAME) {
+        frame_link(manager, link->next)->prev = link->prev;
+    }
+    frame->flags = 0;
+    frame->order = 0;
+    manager->free_blocks[order]--;
+    if (manager->free_lists[order] == PFM_NO_FRAME) {
+        manager->order_bitmap &= ~(1U << order);
+    }
+}
+
+// 设置或清除位图中[index, index + count)的位
+static void frame_bitmap_update(PageFrameManager* manager, uint32_t index, uint32_t count, int allocated) {
+    while (count > 0) {
+        uint32_t bit = index % 32;
+        uint32_t bits = (32 - bit < count) ? 32 - bit : count;
+        uint32_t mask = (bits == 32) ? ~0U : ((1U << bits) - 1) << bit;
+        if (allocated) {
+            manager->frame_bitmap[index / 32] |= mask;
+        } else {
+            manager->frame_bitmap[index / 32] &= ~mask;
+        }
+        index += bits;
+        count -= bits;
+    }
+}
+
+// 为[start_address, start_address + size)建立页面框表，所有页面框初始为已分配（保留），
+// 由pfm_add_free_range把可用的部分交给伙伴分配器
+static int pfm_setup(PageFrameManager* manager, uint32_t start_address, uint32_t size) {
     manager->total_frames = size / PAGE_SIZE;
-    manager->free_frames = manager->total_frames;
+    manager->free_frames = 0;
+    manager->base_frame = start_address / PAGE_SIZE;
+    manager->order_bitmap = 0;
+    for (uint32_t i = 0; i < PFM_ORDER_COUNT; i++) {
+        manager->free_lists[i] = PFM_NO_FRAME;
+        manager->free_blocks[i] = 0;
+        manager->allocations[i] = 0;
+    }
     
-    // 为页面框位图分配内存
+    // 为页面框位图分配内存，初始时全部标记为已分配，加入伙伴链表时再清除
     uint32_t bitmap_size = (manager->total_frames + 31) / 32; // 向上取整到32的倍数
     manager->frame_bitmap = (uint32_t*)malloc(bitmap_size * sizeof(uint32_t));
-    memset(manager->frame_bitmap, 0, bitmap_size * sizeof(uint32_t));
     
     // 分配页面框数组
     manager->frames = (PageFrame*)malloc(manager->total_frames * sizeof(PageFrame));
+    if (!manager->frame_bitmap || !manager->frames) {
+        kernel_printf("Failed to allocate page frame manager tables\n");
+        manager->total_frames = 0;
+        return -1;
+    }
+    memset(manager->frame_bitmap, 0xFF, bitmap_size * sizeof(uint32_t));
     memset(manager->frames, 0, manager->total_frames * sizeof(PageFrame));
+    return 0;
+}
+
+// 把[start, end)内完整的页面框切成尽可能大的自然对齐块，放入空闲链表
+static void pfm_add_free_range(PageFrameManager* manager, uint32_t start, uint32_t end) {
+    uint32_t first = (start + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t last = end / PAGE_SIZE;
+    if (first < manager->base_frame) {
+        first = manager->base_frame;
+    }
+    if (last > manager->base_frame + manager->total_frames) {
+        last = manager->base_frame + manager->total_frames;
+    }
     
-    // 初始化页面框数组
-    for (uint32_t i = 0; i < manager->total_frames; i++) {
-        manager->frames[i].physical_address = start_address + i * PAGE_SIZE;
-        manager->frames[i].reference_count = 0;
-        manager->frames[i].flags = 0;
+    uint32_t index = first - manager->base_frame;
+    uint32_t limit = last > first ? last - manager->base_frame : index;
+    while (index < limit) {
+        uint32_t order = PFM_MAX_ORDER;
+        while (((manager->base_frame + index) & ((1U << order) - 1)) != 0 || index + (1U << order) > limit) {
+            order--;
+        }
+        frame_bitmap_update(manager, index, 1U << order, 0);
+        buddy_push(manager, index, order);
+        manager->free_frames += 1U << order;
+        index += 1U << order;
+    }
+}
+
+// 初始化页面框管理器
+void pfm_init(PageFrameManager* manager, uint32_t start_address, uint32_t size) {
+    // 确保start_address是页对齐的
+    start_address = (start_address + PAGE_SIZE - 1) & PAGE_MASK;
+    
+    if (pfm_setup(manager, start_address, size) != 0) {
+        return;
     }
+    pfm_add_free_range(manager, start_address, start_address + size);
     
     kernel_printf("Page Frame Manager initialized: %d frames available\n", manager->free_frames);
 }
 
-// 分配一个页面框
-uint32_t pfm_allocate_frame() {
+// 把可用区域[start, end)扣除保留区间后加入空闲链表
+static void pfm_add_available(PageFrameManager* manager, uint32_t start, uint32_t end,
+                              const PhysicalRange* reserved, uint32_t reserved_count) {
+    while (reserved_count > 0 && (reserved->end <= start || reserved->start >= end)) {
+        reserved++;
+        reserved_count--;
+    }
+    if (start >= end) {
+        return;
+    }
+    if (reserved_count == 0) {
+        pfm_add_free_range(manager, start, end);
+        return;
+    }
+    
+    // 与第一个保留区间重叠：分别处理它两侧的部分
+    if (reserved->start > start) {
+        pfm_add_available(manager, start, reserved->start, reserved + 1, reserved_count - 1);
+    }
+    if (reserved->end < end) {
+        pfm_add_available(manager, reserved->end, end, reserved + 1, reserved_count - 1);
+    }
+}
+
+// 按multiboot内存映射初始化：页面框表覆盖1MB到最高可用地址（4GB以下），只有类型为可用、
+// 且不与保留区间重叠的页面框进入空闲链表。1MB以下的低端内存留给BIOS和引导数据，不予管理
+void pfm_init_from_multiboot(PageFrameManager* manager, MultibootInfo* info,
+                             const PhysicalRange* reserved, uint32_t reserved_count) {
+    uint32_t low = 0x100000;
+    uint32_t high = low;
+    
+    if (info->flags & MULTIBOOT_INFO_MEM_MAP) {
+        for (uint32_t offset = 0; offset < info->mmap_length; ) {
+            MultibootMmapEntry* entry = (MultibootMmapEntry*)(info->mmap_addr + offset);
+            offset += entry->size + sizeof(entry->size);
+            
+            if (entry->type != MULTIBOOT_MEMORY_AVAILABLE || entry->addr_high != 0) {
+                continue;
+            }
+            // 结束地址截断到4GB以下的最后一页
+            uint32_t end = (entry->len_high != 0 || entry->addr_low + entry->len_low < entry->addr_low)
+                ? PAGE_MASK : ((entry->addr_low + entry->len_low) & PAGE_MASK);
+            if (end > high) {
+                high = end;
+            }
+        }
+    } else if (info->flags & MULTIBOOT_INFO_MEMORY) {
+        high = (low + info->mem_upper * 1024) & PAGE_MASK;
+    }
+    
+    // 内核通过恒等映射直接访问页面框，只管理用户空间下限以下的物理内存
+    if (high > USER_SPACE_START) {
+        kernel_printf("Page Frame Manager: ignoring memory above 0x%x\n", USER_SPACE_START);
+        high = USER_SPACE_START;
+    }
+    
+    if (high <= low || pfm_setup(manager, low, high - low) != 0) {
+        kernel_printf("Page Frame Manager: no usable memory above 1MB\n");
+        return;
+    }
+    
+    if (info->flags & MULTIBOOT_INFO_MEM_MAP) {
+        for (uint32_t offset = 0; offset < info->mmap_length; ) {
+            MultibootMmapEntry* entry = (MultibootMmapEntry*)(info->mmap_addr + offset);
+            offset += entry->size + sizeof(entry->size);
+            
+            if (entry->type != MULTIBOOT_MEMORY_AVAILABLE || entry->addr_high != 0) {
+                continue;
+            }
+            uint32_t end = (entry->len_high != 0 || entry->addr_low + entry->len_low < entry->addr_low)
+                ? PAGE_MASK : entry->addr_low + entry->len_low;
+            pfm_add_available(manager, entry->addr_low, end, reserved, reserved_count);
+        }
+    } else {
+        // 没有内存映射时只能相信mem_upper描述的连续区域
+        pfm_add_available(manager, low, high, reserved, reserved_count);
+    }
+    
+    kernel_printf("Page Frame Manager initialized: %d of %d frames available\n",
+                 manager->free_frames, manager->total_frames);
+}
+
+uint32_t pfm_order_for_count(uint32_t count) {
+    uint32_t order = 0;
+    while ((1U << order) < count) {
+        order++;
+    }
+    return order;
+}
+
+// 分配2^order个连续的页面框
+uint32_t pfm_allocate_frames(uint32_t order) {
     if (!vmm || !vmm->frame_manager) {
         kernel_printf("Page Frame Manager not initialized\n");
         return 0;
     }
+    if (order > PFM_MAX_ORDER) {
+        kernel_printf("Frame order %d exceeds maximum %d\n", order, PFM_MAX_ORDER);
+        return 0;
+    }
     
     PageFrameManager* manager = vmm->frame_manager;
     
-    // 遍历位图寻找空闲页面框
-    for (uint32_t i = 0; i < manager->total_frames; i++) {
-        uint32_t bitmap_index = i / 32;
-        uint32_t bit_index = i % 32;
-        
-        if (!(manager->frame_bitmap[bitmap_index] & (1 << bit_index))) {
-            // 标记为已分配
-            manager->frame_bitmap[bitmap_index] |= (1 << bit_index);
-            manager->free_frames--;
-            manager->frames[i].reference_count++;
-            
-            return manager->frames[i].physical_address;
+    // 缺页处理与后台清零进程都会分配，关中断保护空闲链表
+    uint32_t flags = local_irq_save();
+    
+    // 找不小于order的最小非空链表
+    uint32_t available = manager->order_bitmap & (~0U << order);
+    if (available == 0) {
+        local_irq_restore(flags);
+        kernel_printf("No free page frames available for order %d\n", order);
+        return 0;
+    }
+    uint32_t current = __builtin_ctz(available);
+    uint32_t index = manager->free_lists[current];
+    buddy_remove(manager, index, current);
+    
+    // 逐级拆分，后一半放回低一阶的链表
+    while (current > order) {
+        current--;
+        buddy_push(manager, index + (1U << current), current);
+    }
+    
+    uint32_t count = 1U << order;
+    frame_bitmap_update(manager, index, count, 1);
+    for (uint32_t i = 0; i < count; i++) {
+        manager->frames[index + i].reference_count = 1;
+    }
+    manager->free_frames -= count;
+    manager->allocations[order]++;
+    local_irq_restore(flags);
+    
+    return pfm_frame_address(manager, index);
+}
+
+// 释放2^order个连续的页面框，并与空闲的伙伴逐级合并
+void pfm_free_frames(uint32_t frame_address, uint32_t order) {
+    if (!vmm || !vmm->frame_manager) {
+        kernel_printf("Page Frame Manager not initialized\n");
+        return;
+    }
+    
+    PageFrameManager* manager = vmm->frame_manager;
+    
+    // 计算页面框索引
+    uint32_t index = frame_address / PAGE_SIZE - manager->base_frame;
+    uint32_t count = 1U << order;
+    
+    if (order > PFM_MAX_ORDER || index >= manager->total_frames || index + count > manager->total_frames ||
+        ((manager->base_frame + index) & (count - 1)) != 0) {
+        kernel_printf("Invalid frame block: %x, order %d\n", frame_address, order);
+        return;
+    }
+    
+    // 检查是否已分配
+    for (uint32_t i = index; i < index + count; i++) {
+        if (!(manager->frame_bitmap[i / 32] & (1U << (i % 32)))) {
+            kernel_printf("Frame %x is not allocated\n", pfm_frame_address(manager, i));
+            return;
         }
     }
     
-    kernel_printf("No free page frames available\n");
+    uint32_t flags = local_irq_save();
+    frame_bitmap_update(manager, index, count, 0);
+    for (uint32_t i = index; i < index + count; i++) {
+        manager->frames[i].reference_count = 0;
+        manager->frames[i].flags = 0;
+    }
+    manager->free_frames += count;
+    
+    while (order < PFM_MAX_ORDER) {
+        uint32_t buddy = ((manager->base_frame + index) ^ (1U << order)) - manager->base_frame;
+        if (buddy >= manager->total_frames ||
+            manager->frames[buddy].flags != PAGE_FRAME_FREE_BLOCK || manager->frames[buddy].order != order) {
+            break;
+        }
+        buddy_remove(manager, buddy, order);
+        if (buddy < index) {
+            index = buddy;
+        }
+        order++;
+    }
+    buddy_push(manager, index, order);
+    local_irq_restore(flags);
+}
+
+static uint32_t zeroed_frames[PFM_ZEROED_POOL_SIZE];
+static uint32_t zeroed_frame_count = 0;
+
+// 从清零池中取出一个页面框，池空时返回0。缺页处理与后台清零进程并发访问，关中断保护
+static uint32_t pfm_take_zeroed_frame() {
+    uint32_t flags = local_irq_save();
+    uint32_t frame = zeroed_frame_count ? zeroed_frames[--zeroed_frame_count] : 0;
+    local_irq_restore(flags);
+    return frame;
+}
+
+// 分配一个页面框
+uint32_t pfm_allocate_frame() {
+    uint32_t frame = pfm_allocate_frames(0);
+    // 伙伴分配器耗尽时取用清零池中的页面框
+    if (!frame) {
+        frame = pfm_take_zeroed_frame();
+    }
+    return frame;
+}
+
+uint32_t pfm_allocate_zeroed_frame() {
+    uint32_t frame = pfm_take_zeroed_frame();
+    if (!frame) {
+        frame = pfm_allocate_frames(0);
+        if (frame) {
+            memset((void*)frame, 0, PAGE_SIZE);
+        }
+    }
+    return frame;
+}
+
+uint32_t pfm_refill_zeroed_frames(uint32_t count) {
+    uint32_t filled = 0;
+    while (filled < count && zeroed_frame_count < PFM_ZEROED_POOL_SIZE &&
+           pfm_get_free_frames_count() > PFM_ZEROED_RESERVE) {
+        // 耗时的清零不关中断，只有入池时关中断
+        uint32_t frame = pfm_allocate_frames(0);
+        if (!frame) {
+            break;
+        }
+        memset((void*)frame, 0, PAGE_SIZE);
+        
+        uint32_t flags = local_irq_save();
+        if (zeroed_frame_count < PFM_ZEROED_POOL_SIZE) {
+            zeroed_frames[zeroed_frame_count++] = frame;
+            frame = 0;
+        }
+        local_irq_restore(flags);
+        if (frame) {
+            pfm_free_frame(frame);
+            break;
+        }
+        filled++;
+    }
+    return filled;
+}
+
+// 后台清零进程：以最低优先级运行，只在没有其他就绪进程时得到处理器。
+// 每次只补充少量页面框后就让出处理器
+int pfm_zero_frames_main(int argc, char** argv) {
+    for (;;) {
+        pfm_refill_zeroed_frames(4);
+        yield_cpu();
+    }
     return 0;
 }
 
-// 释放一个页面框
+// 释放一个页面框，引用计数降为0时才真正归还
 void pfm_free_frame(uint32_t frame_address) {
     if (!vmm || !vmm->frame_manager) {
         kernel_printf("Page Frame Manager not initialized\n");
@@ -100,30 +453,72 @@ void pfm_free_frame(uint32_t frame_address) {
     PageFrameManager* manager = vmm->frame_manager;
     
     // 计算页面框索引
-    uint32_t frame_index = (frame_address - manager->frames[0].physical_address) / PAGE_SIZE;
+    uint32_t frame_index = frame_address / PAGE_SIZE - manager->base_frame;
     
     if (frame_index >= manager->total_frames) {
         kernel_printf("Invalid frame address: %x\n", frame_address);
         return;
     }
     
-    // 检查是否已分配
-    uint32_t bitmap_index = frame_index / 32;
-    uint32_t bit_index = frame_index % 32;
-    
-    if (!(manager->frame_bitmap[bitmap_index] & (1 << bit_index))) {
+    if (!(manager->frame_bitmap[frame_index / 32] & (1U << (frame_index % 32)))) {
         kernel_printf("Frame %x is not allocated\n", frame_address);
         return;
     }
     
     // 减少引用计数
+    uint32_t flags = local_irq_save();
     manager->frames[frame_index].reference_count--;
     
     // 如果引用计数为0，释放页面框
     if (manager->frames[frame_index].reference_count == 0) {
-        manager->frame_bitmap[bitmap_index] &= ~(1 << bit_index);
-        manager->free_frames++;
-        manager->frames[frame_index].flags = 0;
+        pfm_free_frames(frame_address, 0);
+    }
+    local_irq_restore(flags);
+}
+
+// 已分配的受管页面框的描述符，其他情况返回NULL
+static PageFrame* pfm_lookup(uint32_t frame_address) {
+    if (!vmm || !vmm->frame_manager) {
+        return NULL;
+    }
+
+    PageFrameManager* manager = vmm->frame_manager;
+    uint32_t frame_index = frame_address / PAGE_SIZE - manager->base_frame;
+    if (frame_index >= manager->total_frames ||
+        !(manager->frame_bitmap[frame_index / 32] & (1U << (frame_index % 32)))) {
+        return NULL;
+    }
+    return &manager->frames[frame_index];
+}
+
+// 增加页面框的引用计数
+int pfm_ref_frame(uint32_t frame_address) {
+    PageFrame* frame = pfm_lookup(frame_address);
+    if (!frame || frame->reference_count == 0xFFFF) {
+        return -1;
+    }
+    frame->reference_count++;
+    return 0;
+}
+
+// 获取页面框的引用计数，不受管理的页面框返回0
+uint32_t pfm_get_reference_count(uint32_t frame_address) {
+    PageFrame* frame = pfm_lookup(frame_address);
+    return frame ? frame->reference_count : 0;
+}
+
+// 打印各阶的空闲块数和累计分配次数
+void pfm_print_status() {
+    if (!vmm || !vmm->frame_manager) {
+        kernel_printf("Page Frame Manager not initialized\n");
+        return;
+    }
+    
+    PageFrameManager* manager = vmm->frame_manager;
+    kernel_printf("Page frames: %d total, %d free\n", manager->total_frames, manager->free_frames);
+    for (uint32_t order = 0; order < PFM_ORDER_COUNT; order++) {
+        kernel_printf("  Order %d (%d KB): %d free blocks, %d allocations\n",
+                     order, (PAGE_SIZE << order) / 1024, manager->free_blocks[order], manager->allocations[order]);
     }
 }
 
@@ -136,28 +531,101 @@ uint32_t pfm_get_free_frames_count() {
     return vmm->frame_manager->free_frames;
 }
 
+static inline int paging_enabled() {
+    return (get_cr0() & 0x80000000) != 0;
+}
+
+// 第i个页目录项是否为所有地址空间共享的内核映射：内核空间和低端的恒等映射
+static inline int pd_is_kernel_entry(uint32_t i) {
+    return i >= 768 || (vmm && (i << 22) < vmm->identity_end);
+}
+
+// 取得可以访问directory各项的地址。分页启用前物理地址可直接访问；启用后当前页目录经
+// 自身的递归映射访问，其他页目录挂接到外部窗口，一次只能挂接一个。
+// 外部窗口为所有执行流共用，调用者从pd_view起到不再使用视图为止须保持关中断，
+// 否则中断中的地址空间回收可能改挂或清除窗口
+static PageDirectory* pd_view(PageDirectory* directory) {
+    if (!paging_enabled()) {
+        return directory;
+    }
+    if ((uint32_t)directory == get_cr3()) {
+        return (PageDirectory*)PD_SELF_DIRECTORY;
+    }
+    
+    PageDirectoryEntry* slot = &((PageDirectory*)PD_SELF_DIRECTORY)->entries[PD_FOREIGN_INDEX];
+    if (!slot->present || slot->page_table_base_address != (uint32_t)directory >> 12) {
+        memset(slot, 0, sizeof(PageDirectoryEntry));
+        slot->present = 1;
+        slot->read_write = 1;
+        slot->page_table_base_address = (uint32_t)directory >> 12;
+        // 整个外部窗口都换了内容，重载CR3一次刷新
+        set_cr3(get_cr3());
+    }
+    return (PageDirectory*)PD_FOREIGN_DIRECTORY;
+}
+
+// 解除外部窗口对directory的挂接，页目录释放前调用
+static void pd_detach(PageDirectory* directory) {
+    if (!paging_enabled()) {
+        return;
+    }
+    PageDirectoryEntry* slot = &((PageDirectory*)PD_SELF_DIRECTORY)->entries[PD_FOREIGN_INDEX];
+    if (slot->present && slot->page_table_base_address == (uint32_t)directory >> 12) {
+        memset(slot, 0, sizeof(PageDirectoryEntry));
+        set_cr3(get_cr3());
+    }
+}
+
+// 第dir_index个页表的访问地址，view为pd_view的结果
+static PageTable* pd_table(PageDirectory* view, uint32_t dir_index) {
+    if (!paging_enabled()) {
+        return (PageTable*)(view->entries[dir_index].page_table_base_address << 12);
+    }
+    uint32_t window = (view == (PageDirectory*)PD_SELF_DIRECTORY) ? PD_SELF_TABLES : PD_FOREIGN_TABLES;
+    return (PageTable*)(window + dir_index * PAGE_SIZE);
+}
+
+// 页目录项指向的页表改变后，刷新页表窗口中对应的一页
+static inline void pd_flush_table_window(PageDirectory* view, uint32_t dir_index) {
+    if (paging_enabled()) {
+        asm volatile ("invlpg (%0)" : : "r"(pd_table(view, dir_index)) : "memory");
+    }
+}
+
 // 创建页目录
 PageDirectory* pd_create() {
     // 分配页目录内存
-    PageDirectory* directory = (PageDirectory*)malloc(sizeof(PageDirectory));
+    PageDirectory* directory = (PageDirectory*)kmalloc_pages(1);
     if (!directory) {
         kernel_printf("Failed to allocate memory for page directory\n");
         return NULL;
     }
     
-    memset(directory, 0, sizeof(PageDirectory));
-    
-    // 如果是内核页目录，需要复制内核空间的映射
-    if (vmm && vmm->kernel_directory && directory != vmm->kernel_directory) {
-        // 复制内核空间的页目录项（假设内核空间从第768个页目录项开始）
-        for (uint32_t i = 768; i < PAGE_DIR_ENTRIES; i++) {
-            directory->entries[i] = vmm->kernel_directory->entries[i];
+    uint32_t irq = local_irq_save();
+    PageDirectory* view = pd_view(directory);
+    memset(view, 0, sizeof(PageDirectory));
+    
+    // 复制内核空间和低端恒等映射的页目录项。分页启用后当前页目录的这些项与内核页目录相同，
+    // 直接从当前页目录复制，外部窗口留给新页目录
+    if (vmm && vmm->kernel_directory) {
+        PageDirectory* kernel_view = paging_enabled() ? (PageDirectory*)PD_SELF_DIRECTORY : vmm->kernel_directory;
+        for (uint32_t i = 0; i < PD_FOREIGN_INDEX; i++) {
+            if (pd_is_kernel_entry(i)) {
+                view->entries[i] = kernel_view->entries[i];
+            }
         }
     }
     
+    view->entries[PD_SELF_INDEX].present = 1;
+    view->entries[PD_SELF_INDEX].read_write = 1;
+    view->entries[PD_SELF_INDEX].page_table_base_address = (uint32_t)directory >> 12;
+    local_irq_restore(irq);
+    
     return directory;
 }
 
+static void pd_release_tables(PageDirectory* directory, uint32_t count);
+
 // 销毁页目录
 void pd_destroy(PageDirectory* directory) {
     if (!directory || directory == vmm->kernel_directory) {
@@ -165,15 +633,13 @@ void pd_destroy(PageDirectory* directory) {
         return;
     }
     
-    // 释放所有用户空间页表
-    for (uint32_t i = 0; i < 768; i++) {
-        if (directory->entries[i].present) {
-            PageTable* table = (PageTable*)(directory->entries[i].page_table_base_address << 12);
-            free(table);
-        }
-    }
+    // 归还用户空间页表中每个页面框的引用并释放页表，共享的内核页目录项不属于它
+    uint32_t irq = local_irq_save();
+    pd_release_tables(directory, 768);
+    pd_detach(directory);
+    local_irq_restore(irq);
     
-    free(directory);
+    kfree_pages(directory, 1);
 }
 
 // 获取虚拟地址对应的物理地址
@@ -185,23 +651,25 @@ uint32_t pd_get_physical_address(PageDirectory* directory, uint32_t virtual_addr
     // 计算页目录索引和页表索引
     uint32_t dir_index = (virtual_address >> 22) & 0x3FF;
     uint32_t table_index = (virtual_address >> 12) & 0x3FF;
-    
-    // 检查页目录项是否存在
-    if (!directory->entries[dir_index].present) {
-        return 0;
-    }
-    
-    // 获取页表
-    PageTable* table = (PageTable*)(directory->entries[dir_index].page_table_base_address << 12);
-    
-    // 检查页表项是否存在
-    if (!table->entries[table_index].present) {
-        return 0;
+    uint32_t irq = local_irq_save();
+    PageDirectory* view = pd_view(directory);
+    uint32_t physical_address = 0;
+    
+    if (!view->entries[dir_index].present) {
+        // 页目录项不存在
+    } else if (view->entries[dir_index].page_size) {
+        // 大页：页目录项直接给出4MB页面的基地址
+        physical_address = ((view->entries[dir_index].page_table_base_address << 12) & LARGE_PAGE_MASK) |
+                           (virtual_address & ~LARGE_PAGE_MASK);
+    } else {
+        // 页表项存在时计算物理地址
+        PageTable* table = pd_table(view, dir_index);
+        if (table->entries[table_index].present) {
+            physical_address = (table->entries[table_index].page_base_address << 12) |
+                               (virtual_address & OFFSET_MASK);
+        }
     }
-    
-    // 计算物理地址
-    uint32_t physical_address = (table->entries[table_index].page_base_address << 12) | 
-                                (virtual_address & OFFSET_MASK);
+    local_irq_restore(irq);
     
     return physical_address;
 }
@@ -217,6 +685,50 @@ void pd_switch(PageDirectory* directory) {
     set_cr3((uint32_t)directory);
 }
 
+// 取得映射dir_index所在4MB时使用的页表，页目录项不存在时创建页表。大页或分配失败时返回NULL
+static PageTable* pd_table_for_map(PageDirectory* view, uint32_t dir_index, uint32_t flags) {
+    PageDirectoryEntry* dir_entry = &view->entries[dir_index];
+    
+    // 大页覆盖的范围不能再按4KB映射
+    if (dir_entry->present && dir_entry->page_size) {
+        return NULL;
+    }
+    
+    // 如果页目录项不存在，创建页表。页表只经页表窗口访问，直接取一个页面框
+    if (!dir_entry->present) {
+        uint32_t table_physical = pfm_allocate_frame();
+        if (!table_physical) {
+            return NULL;
+        }
+        
+        // 更新页目录项。页表内的页面权限各不相同（按需映射时先映射的未必可写），
+        // 权限只由页表项控制，页目录项总是可写
+        dir_entry->present = 1;
+        dir_entry->read_write = 1;
+        dir_entry->user_supervisor = (flags & PTE_USER) ? 1 : 0;
+        dir_entry->write_through = (flags & PTE_WRITE_THROUGH) ? 1 : 0;
+        dir_entry->cache_disabled = (flags & PTE_CACHE_DISABLED) ? 1 : 0;
+        dir_entry->page_table_base_address = table_physical >> 12;
+        
+        pd_flush_table_window(view, dir_index);
+        memset(pd_table(view, dir_index), 0, sizeof(PageTable));
+    } else if (flags & PTE_USER) {
+        dir_entry->user_supervisor = 1;
+    }
+    
+    return pd_table(view, dir_index);
+}
+
+static inline void pd_set_entry(PageTableEntry* entry, uint32_t physical_address, uint32_t flags) {
+    entry->present = 1;
+    entry->read_write = (flags & PTE_WRITABLE) ? 1 : 0;
+    entry->user_supervisor = (flags & PTE_USER) ? 1 : 0;
+    entry->write_through = (flags & PTE_WRITE_THROUGH) ? 1 : 0;
+    entry->cache_disabled = (flags & PTE_CACHE_DISABLED) ? 1 : 0;
+    entry->global = (flags & PTE_GLOBAL) ? 1 : 0;
+    entry->page_base_address = physical_address >> 12;
+}
+
 // 映射虚拟页到物理页
 int pd_map_page(PageDirectory* directory, uint32_t virtual_address, uint32_t physical_address, uint32_t flags) {
     if (!directory || !physical_address) {
@@ -227,35 +739,185 @@ int pd_map_page(PageDirectory* directory, uint32_t virtual_address, uint32_t phy
     uint32_t dir_index = (virtual_address >> 22) & 0x3FF;
     uint32_t table_index = (virtual_address >> 12) & 0x3FF;
     
-    // 如果页目录项不存在，创建页表
-    if (!directory->entries[dir_index].present) {
-        PageTable* table = (PageTable*)malloc(sizeof(PageTable));
+    // 获取页表
+    uint32_t irq = local_irq_save();
+    PageTable* table = pd_table_for_map(pd_view(directory), dir_index, flags);
+    if (!table) {
+        local_irq_restore(irq);
+        return -1;
+    }
+    
+    // 更新页表项
+    pd_set_entry(&table->entries[table_index], physical_address, flags);
+    local_irq_restore(irq);
+    
+    // 刷新TLB
+    asm volatile ("invlpg (%0)" : : "r"(virtual_address));
+    
+    return 0;
+}
+
+// 统一刷新一次范围操作改动的TLB项。只有当前地址空间需要刷新；页数不超过阈值时逐页invlpg，
+// 否则重载CR3一次。全局页不随CR3重载刷新，涉及全局页时改为翻转CR4.PGE
+static void pd_flush_range(PageDirectory* directory, uint32_t virtual_address, uint32_t size, int global) {
+    if (get_cr3() != (uint32_t)directory) {
+        return;
+    }
+    
+    if (size / PAGE_SIZE <= TLB_FLUSH_THRESHOLD) {
+        for (uint32_t offset = 0; offset < size; offset += PAGE_SIZE) {
+            asm volatile ("invlpg (%0)" : : "r"(virtual_address + offset) : "memory");
+        }
+    } else if (global && (get_cr4() & CR4_PGE)) {
+        uint32_t cr4 = get_cr4();
+        set_cr4(cr4 & ~CR4_PGE);
+        set_cr4(cr4);
+    } else {
+        set_cr3(get_cr3());
+    }
+}
+
+// 按范围映射的共同实现：allocate非0时为每页分配新的页面框，否则映射从physical_address起的
+// 连续物理内存。每个4MB跨度只取一次页表，失败时撤销本次建立的映射
+static int pd_map_pages(PageDirectory* directory, uint32_t virtual_address, uint32_t physical_address,
+                        uint32_t size, uint32_t flags, int allocate) {
+    virtual_address = virtual_address & PAGE_MASK;
+    physical_address = physical_address & PAGE_MASK;
+    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+    
+    uint32_t irq = local_irq_save();
+    PageDirectory* view = pd_view(directory);
+    uint32_t remaining = size / PAGE_SIZE;
+    uint32_t mapped = 0;
+    while (remaining > 0) {
+        uint32_t address = virtual_address + mapped * PAGE_SIZE;
+        uint32_t table_index = (address >> 12) & 0x3FF;
+        uint32_t count = PAGE_TABLE_ENTRIES - table_index;
+        if (count > remaining) {
+            count = remaining;
+        }
+        
+        PageTable* table = pd_table_for_map(view, address >> 22, flags);
         if (!table) {
-            return -1;
+            break;
+        }
+        uint32_t i;
+        for (i = 0; i < count; i++) {
+            uint32_t physical = allocate ? pfm_allocate_frame() : physical_address + (mapped + i) * PAGE_SIZE;
+            if (!physical) {
+                break;
+            }
+            pd_set_entry(&table->entries[table_index + i], physical, flags);
+        }
+        mapped += i;
+        if (i < count) {
+            break;
+        }
+        remaining -= count;
+    }
+    
+    if (mapped < size / PAGE_SIZE) {
+        // 映射失败，释放已映射的页面
+        pd_unmap_range(directory, virtual_address, mapped * PAGE_SIZE);
+        local_irq_restore(irq);
+        return -1;
+    }
+    
+    pd_flush_range(directory, virtual_address, size, flags & PTE_GLOBAL);
+    local_irq_restore(irq);
+    return 0;
+}
+
+// 按范围映射连续物理内存
+int pd_map_range(PageDirectory* directory, uint32_t virtual_address, uint32_t physical_address, uint32_t size,
+                 uint32_t flags) {
+    if (!directory || !physical_address) {
+        return -1;
+    }
+    return pd_map_pages(directory, virtual_address, physical_address, size, flags, 0);
+}
+
+// 按范围解除映射
+int pd_unmap_range(PageDirectory* directory, uint32_t virtual_address, uint32_t size) {
+    if (!directory) {
+        return -1;
+    }
+    
+    virtual_address = virtual_address & PAGE_MASK;
+    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+    
+    uint32_t irq = local_irq_save();
+    PageDirectory* view = pd_view(directory);
+    uint32_t remaining = size / PAGE_SIZE;
+    uint32_t address = virtual_address;
+    int changed = 0;
+    int global = 0;
+    int result = 0;
+    while (remaining > 0) {
+        uint32_t dir_index = address >> 22;
+        uint32_t table_index = (address >> 12) & 0x3FF;
+        uint32_t count = PAGE_TABLE_ENTRIES - table_index;
+        if (count > remaining) {
+            count = remaining;
+        }
+        
+        PageDirectoryEntry* dir_entry = &view->entries[dir_index];
+        if (dir_entry->present && dir_entry->page_size) {
+            // 大页不能按4KB解除映射
+            result = -1;
+        } else if (dir_entry->present) {
+            PageTable* table = pd_table(view, dir_index);
+            for (uint32_t i = table_index; i < table_index + count; i++) {
+                if (!table->entries[i].present) {
+                    continue;
+                }
+                uint32_t physical_address = table->entries[i].page_base_address << 12;
+                global |= table->entries[i].global;
+                memset(&table->entries[i], 0, sizeof(PageTableEntry));
+                // 与pd_release_tables一致：设备内存等不受管理的页面框只解除映射
+                if (pfm_get_reference_count(physical_address) > 0) {
+                    pfm_free_frame(physical_address);
+                }
+                changed = 1;
+            }
         }
-        memset(table, 0, sizeof(PageTable));
         
-        // 更新页目录项
-        directory->entries[dir_index].present = 1;
-        directory->entries[dir_index].read_write = (flags & PTE_WRITABLE) ? 1 : 0;
-        directory->entries[dir_index].user_supervisor = (flags & PTE_USER) ? 1 : 0;
-        directory->entries[dir_index].write_through = (flags & PTE_WRITE_THROUGH) ? 1 : 0;
-        directory->entries[dir_index].cache_disabled = (flags & PTE_CACHE_DISABLED) ? 1 : 0;
-        directory->entries[dir_index].page_table_base_address = (uint32_t)table >> 12;
+        address += count * PAGE_SIZE;
+        remaining -= count;
     }
     
-    // 获取页表
-    PageTable* table = (PageTable*)(directory->entries[dir_index].page_table_base_address << 12);
+    if (changed) {
+        pd_flush_range(directory, virtual_address, size, global);
+    }
+    local_irq_restore(irq);
+    return result;
+}
+
+// 映射4MB大页
+int pd_map_large_page(PageDirectory* directory, uint32_t virtual_address, uint32_t physical_address, uint32_t flags) {
+    if (!directory || (virtual_address & ~LARGE_PAGE_MASK) || (physical_address & ~LARGE_PAGE_MASK)) {
+        return -1;
+    }
     
-    // 更新页表项
-    table->entries[table_index].present = 1;
-    table->entries[table_index].read_write = (flags & PTE_WRITABLE) ? 1 : 0;
-    table->entries[table_index].user_supervisor = (flags & PTE_USER) ? 1 : 0;
-    table->entries[table_index].write_through = (flags & PTE_WRITE_THROUGH) ? 1 : 0;
-    table->entries[table_index].cache_disabled = (flags & PTE_CACHE_DISABLED) ? 1 : 0;
-    table->entries[table_index].page_base_address = physical_address >> 12;
+    // 已指向页表的目录项不能直接替换，否则页表中的映射会丢失
+    uint32_t irq = local_irq_save();
+    PageDirectoryEntry* entry = &pd_view(directory)->entries[virtual_address >> 22];
+    if (entry->present && !entry->page_size) {
+        local_irq_restore(irq);
+        return -1;
+    }
+    
+    memset(entry, 0, sizeof(PageDirectoryEntry));
+    entry->present = 1;
+    entry->read_write = (flags & PTE_WRITABLE) ? 1 : 0;
+    entry->user_supervisor = (flags & PTE_USER) ? 1 : 0;
+    entry->write_through = (flags & PTE_WRITE_THROUGH) ? 1 : 0;
+    entry->cache_disabled = (flags & PTE_CACHE_DISABLED) ? 1 : 0;
+    entry->page_size = 1;
+    entry->global = (flags & PTE_GLOBAL) ? 1 : 0;
+    entry->page_table_base_address = physical_address >> 12;
+    local_irq_restore(irq);
     
-    // 刷新TLB
     asm volatile ("invlpg (%0)" : : "r"(virtual_address));
     
     return 0;
@@ -266,43 +928,205 @@ int pd_unmap_page(PageDirectory* directory, uint32_t virtual_address) {
     if (!directory) {
         return -1;
     }
-    
-    // 计算页目录索引和页表索引
-    uint32_t dir_index = (virtual_address >> 22) & 0x3FF;
-    uint32_t table_index = (virtual_address >> 12) & 0x3FF;
-    
-    // 检查页目录项是否存在
-    if (!directory->entries[dir_index].present) {
-        return 0;
-    }
-    
-    // 获取页表
-    PageTable* table = (PageTable*)(directory->entries[dir_index].page_table_base_address << 12);
-    
-    // 检查页表项是否存在
-    if (!table->entries[table_index].present) {
-        return 0;
+    
+    // 计算页目录索引和页表索引
+    uint32_t dir_index = (virtual_address >> 22) & 0x3FF;
+    uint32_t table_index = (virtual_address >> 12) & 0x3FF;
+    uint32_t irq = local_irq_save();
+    PageDirectory* view = pd_view(directory);
+    
+    // 检查页目录项是否存在
+    if (!view->entries[dir_index].present) {
+        local_irq_restore(irq);
+        return 0;
+    }
+    
+    // 大页不能按4KB解除映射
+    if (view->entries[dir_index].page_size) {
+        local_irq_restore(irq);
+        return -1;
+    }
+    
+    // 获取页表
+    PageTable* table = pd_table(view, dir_index);
+    
+    // 检查页表项是否存在
+    if (!table->entries[table_index].present) {
+        local_irq_restore(irq);
+        return 0;
+    }
+    
+    // 保存物理地址以便释放页面框
+    uint32_t physical_address = table->entries[table_index].page_base_address << 12;
+    
+    // 清除页表项
+    memset(&table->entries[table_index], 0, sizeof(PageTableEntry));
+    local_irq_restore(irq);
+    
+    // 刷新TLB
+    asm volatile ("invlpg (%0)" : : "r"(virtual_address));
+    
+    // 释放页面框
+    pfm_free_frame(physical_address);
+
+    return 0;
+}
+
+// 获取虚拟地址对应的页表项，页表不存在时返回NULL。
+// 返回的指针位于页表窗口中，挂接其他页目录后失效，调用者须在关中断期间使用
+static PageTableEntry* pd_get_entry(PageDirectory* directory, uint32_t virtual_address) {
+    uint32_t dir_index = (virtual_address >> 22) & 0x3FF;
+    PageDirectory* view = pd_view(directory);
+    PageDirectoryEntry* dir_entry = &view->entries[dir_index];
+    if (!dir_entry->present || dir_entry->page_size) {
+        return NULL;
+    }
+    return &pd_table(view, dir_index)->entries[(virtual_address >> 12) & 0x3FF];
+}
+
+// 释放用户页表[0, count)，并归还其中页面框的引用
+static void pd_release_tables(PageDirectory* directory, uint32_t count) {
+    PageDirectory* view = pd_view(directory);
+    for (uint32_t i = 0; i < count; i++) {
+        if (!view->entries[i].present || view->entries[i].page_size || pd_is_kernel_entry(i)) {
+            continue;
+        }
+        PageTable* table = pd_table(view, i);
+        for (uint32_t j = 0; j < PAGE_TABLE_ENTRIES; j++) {
+            uint32_t physical_address = table->entries[j].page_base_address << 12;
+            if (table->entries[j].present && pfm_get_reference_count(physical_address) > 0) {
+                pfm_free_frame(physical_address);
+            }
+        }
+        pfm_free_frame(view->entries[i].page_table_base_address << 12);
+        memset(&view->entries[i], 0, sizeof(PageDirectoryEntry));
+        pd_flush_table_window(view, i);
+    }
+}
+
+// 写时复制地复制页目录。共享的内核页目录项直接复制；不受页面框管理器管理的
+// 页面（如设备内存）原样共享，不参与写时复制。
+// 分页启用后源页目录须经自身的递归映射访问，不是当前页目录时临时切换过去，新页目录挂接在外部窗口
+PageDirectory* pd_clone(PageDirectory* source) {
+    if (!source) {
+        return NULL;
+    }
+
+    // 临时切换的CR3和外部窗口在复制期间都不能被中断中的代码改动
+    uint32_t irq = local_irq_save();
+    uint32_t saved_cr3 = get_cr3();
+    if (paging_enabled() && saved_cr3 != (uint32_t)source) {
+        set_cr3((uint32_t)source);
+    }
+
+    PageDirectory* directory = pd_create();
+    if (!directory) {
+        if (get_cr3() != saved_cr3) {
+            set_cr3(saved_cr3);
+        }
+        local_irq_restore(irq);
+        return NULL;
+    }
+
+    PageDirectory* source_view = pd_view(source);
+    PageDirectory* view = pd_view(directory);
+    for (uint32_t i = 0; i < 768; i++) {
+        PageDirectoryEntry* source_entry = &source_view->entries[i];
+        if (!source_entry->present || pd_is_kernel_entry(i)) {
+            continue;
+        }
+        if (source_entry->page_size) {
+            view->entries[i] = *source_entry;
+            continue;
+        }
+
+        uint32_t table_physical = pfm_allocate_frame();
+        if (!table_physical) {
+            kernel_printf("Failed to allocate page table for clone\n");
+            pd_release_tables(directory, i);
+            pd_detach(directory);
+            kfree_pages(directory, 1);
+            if (get_cr3() != saved_cr3) {
+                set_cr3(saved_cr3);
+            }
+            local_irq_restore(irq);
+            return NULL;
+        }
+
+        view->entries[i] = *source_entry;
+        view->entries[i].page_table_base_address = table_physical >> 12;
+        pd_flush_table_window(view, i);
+
+        PageTable* source_table = pd_table(source_view, i);
+        PageTable* table = pd_table(view, i);
+        for (uint32_t j = 0; j < PAGE_TABLE_ENTRIES; j++) {
+            PageTableEntry* entry = &source_table->entries[j];
+            if (entry->present && pfm_ref_frame(entry->page_base_address << 12) == 0 && entry->read_write &&
+                !(entry->available & PTE_AVAIL_SHARED)) {
+                entry->read_write = 0;
+                entry->available |= PTE_AVAIL_COW;
+            }
+            table->entries[j] = *entry;
+        }
+    }
+
+    // 源地址空间的可写页面刚被改为只读，正在使用时需要刷新TLB；临时切换过的在此切换回去
+    if (get_cr3() == (uint32_t)source) {
+        set_cr3(saved_cr3);
+    }
+    local_irq_restore(irq);
+
+    return directory;
+}
+
+// 全零的共享页面框，匿名内存的读缺页都只读地映射它；首次使用时分配，此后一直持有一个引用，
+// 因此映射它的页表项总按写时复制处理
+static uint32_t zero_page = 0;
+
+static uint32_t vmm_zero_page() {
+    if (!zero_page) {
+        zero_page = pfm_allocate_zeroed_frame();
+    }
+    return zero_page;
+}
+
+// 处理对写时复制页面的写入：仍有其他共享者时复制一份私有页面，
+// 只剩自己时直接恢复可写，成功返回0
+static int handle_cow_fault(PageDirectory* directory, uint32_t fault_address) {
+    uint32_t irq = local_irq_save();
+    PageTableEntry* entry = pd_get_entry(directory, fault_address);
+    if (!entry || !entry->present || !(entry->available & PTE_AVAIL_COW)) {
+        local_irq_restore(irq);
+        return -1;
+    }
+
+    uint32_t old_physical = entry->page_base_address << 12;
+    if (pfm_get_reference_count(old_physical) > 1) {
+        // 共享零页面不必复制内容，换成一个清零的页面框即可
+        uint32_t new_physical = (old_physical == zero_page) ? pfm_allocate_zeroed_frame() : pfm_allocate_frame();
+        if (!new_physical) {
+            local_irq_restore(irq);
+            return -1;
+        }
+        if (old_physical != zero_page) {
+            memcpy((void*)new_physical, (void*)old_physical, PAGE_SIZE);
+        }
+        entry->page_base_address = new_physical >> 12;
+        pfm_free_frame(old_physical);
     }
-    
-    // 保存物理地址以便释放页面框
-    uint32_t physical_address = table->entries[table_index].page_base_address << 12;
-    
-    // 清除页表项
-    memset(&table->entries[table_index], 0, sizeof(PageTableEntry));
-    
-    // 刷新TLB
-    asm volatile ("invlpg (%0)" : : "r"(virtual_address));
-    
-    // 释放页面框
-    pfm_free_frame(physical_address);
-    
+
+    entry->read_write = 1;
+    entry->available &= ~PTE_AVAIL_COW;
+    local_irq_restore(irq);
+    asm volatile ("invlpg (%0)" : : "r"(fault_address));
     return 0;
 }
 
 // 启用分页
 void enable_paging() {
     uint32_t cr0 = get_cr0();
-    set_cr0(cr0 | 0x80000000); // 设置CR0的PG位
+    // 同时设置WP位，使内核写只读的写时复制页面时也触发页面故障
+    set_cr0(cr0 | 0x80010000); // 设置CR0的PG位和WP位
 }
 
 // 禁用分页
@@ -316,87 +1140,118 @@ uint32_t get_current_page_directory() {
     return get_cr3();
 }
 
+// 内存映射文件的缺页：从页缓存取得页面。共享映射直接映射缓存页；私有映射读时只读地
+// 映射缓存页并标记写时复制，写时直接复制一份私有页面
+static int handle_file_fault(PageDirectory* directory, MemoryRegion* region, uint32_t fault_address, uint32_t error_code) {
+    uint32_t page_address = fault_address & PAGE_MASK;
+    uint32_t index = (region->file_offset + (page_address - region->virtual_address)) / PAGE_SIZE;
+    uint32_t frame = page_cache_get_page(region->file, index);
+    if (!frame) {
+        return -1;
+    }
+    
+    uint32_t flags = region->flags;
+    uint32_t available = 0;
+    if (!region->shared && (error_code & PF_WRITE)) {
+        uint32_t copy = pfm_allocate_frame();
+        if (!copy) {
+            return -1;
+        }
+        memcpy((void*)copy, (void*)frame, PAGE_SIZE);
+        frame = copy;
+    } else {
+        pfm_ref_frame(frame);
+        if (region->shared) {
+            available = PTE_AVAIL_SHARED;
+        } else if (flags & PTE_WRITABLE) {
+            flags &= ~PTE_WRITABLE;
+            available = PTE_AVAIL_COW;
+        }
+    }
+    
+    uint32_t irq = local_irq_save();
+    if (pd_map_page(directory, page_address, frame, flags) != 0) {
+        local_irq_restore(irq);
+        pfm_free_frame(frame);
+        return -1;
+    }
+    pd_get_entry(directory, page_address)->available = available;
+    local_irq_restore(irq);
+    return 0;
+}
+
+// 按需分页：缺页地址落在进程的某个内存区域内时，读缺页映射共享零页面，写缺页分配一个清零的
+// 页面并按区域权限映射，成功返回0。区域创建时只登记地址范围，页面在第一次访问时才分配
+static int handle_demand_fault(Process* process, uint32_t fault_address, uint32_t error_code) {
+    MemoryRegion* region = vmm_find_region(&process->memory_regions, fault_address);
+    if (!region || ((error_code & PF_WRITE) && !(region->flags & PTE_WRITABLE))) {
+        return -1;
+    }
+    
+    if (region->type == MEMORY_MAPPED_FILE && region->file) {
+        return handle_file_fault(process->page_directory, region, fault_address, error_code);
+    }
+    
+    // 读未触及的页面：映射共享零页面并标记写时复制（区域只读时也标记，mprotect改为可写后
+    // 仍由写时复制处理），写入时才分配私有页面
+    uint32_t page_address = fault_address & PAGE_MASK;
+    if (!(error_code & PF_WRITE)) {
+        uint32_t zero = vmm_zero_page();
+        if (zero && pfm_ref_frame(zero) == 0) {
+            uint32_t irq = local_irq_save();
+            if (pd_map_page(process->page_directory, page_address, zero, region->flags & ~PTE_WRITABLE) != 0) {
+                local_irq_restore(irq);
+                pfm_free_frame(zero);
+                return -1;
+            }
+            pd_get_entry(process->page_directory, page_address)->available = PTE_AVAIL_COW;
+            local_irq_restore(irq);
+            return 0;
+        }
+    }
+    
+    // 写缺页：清零的页面框通常由后台清零进程预先准备好
+    uint32_t physical_address = pfm_allocate_zeroed_frame();
+    if (!physical_address) {
+        return -1;
+    }
+    
+    if (pd_map_page(process->page_directory, page_address, physical_address, region->flags) != 0) {
+        pfm_free_frame(physical_address);
+        return -1;
+    }
+    return 0;
+}
+
 // 页面故障处理函数
 void page_fault_handler(uint32_t error_code) {
     // 获取导致页面故障的虚拟地址
     uint32_t fault_address;
     asm volatile ("mov %%cr2, %0" : "=r"(fault_address));
     
-    // 检查是否是用户模式下的页面错误
-    if (error_code & 0x4) {
-        if (!process_manager || !process_manager->current_process) {
-            kernel_printf("User page fault but no current process\n");
-            for (;;);
+    // 写时复制：内核代替进程写用户页面（如系统调用填充缓冲区）时同样会触发，
+    // 因此不区分特权级，直接查当前页目录。mprotect设为只读的区域保留写时复制标记，不在此恢复可写
+    if ((error_code & PF_PROTECTION) && (error_code & PF_WRITE)) {
+        MemoryRegion* region = NULL;
+        if (fault_address < USER_SPACE_END && process_manager && process_manager->current_process) {
+            region = vmm_find_region(&process_manager->current_process->memory_regions, fault_address);
         }
-        
-        Process* current = process_manager->current_process;
-        
-        // 检查是否是写保护错误（可能是写时复制）
-        if (!(error_code & 0x1) && (error_code & 0x2)) {
-            // 这是一个保护违例，可能是写时复制页面
-            uint32_t dir_index = (fault_address >> 22) & 0x3FF;
-            uint32_t table_index = (fault_address >> 12) & 0x3FF;
-            
-            if (current->page_directory->entries[dir_index].present) {
-                PageTable* table = (PageTable*)(current->page_directory->entries[dir_index].page_table_base_address << 12);
-                if (table->entries[table_index].present) {
-                    // 检查是否是写时复制页面（只读标记，但尝试写入）
-                    if (!table->entries[table_index].read_write) {
-                        // 分配新的物理页面
-                        uint32_t new_physical = pfm_allocate_frame();
-                        if (new_physical) {
-                            // 复制旧页面内容到新页面
-                            uint32_t old_physical = table->entries[table_index].page_base_address << 12;
-                            memcpy((void*)new_physical, (void*)old_physical, PAGE_SIZE);
-                            
-                            // 更新页表项，映射到新页面并设置可写
-                            table->entries[table_index].page_base_address = new_physical >> 12;
-                            table->entries[table_index].read_write = 1;
-                            
-                            // 刷新TLB
-                            asm volatile ("invlpg (%0)" : : "r"(fault_address));
-                            return; // 成功处理，返回继续执行
-                        }
-                    }
-                }
-            }
+        if ((!region || (region->flags & PTE_WRITABLE)) &&
+            handle_cow_fault((PageDirectory*)get_cr3(), fault_address) == 0) {
+            return;
         }
-        
-        // 检查是否是页面不存在错误（可能是按需分页）
-        if (error_code & 0x1) {
-            // 检查内存区域链表，看是否有这个虚拟地址范围的映射
-            MemoryRegion* region = current->memory_regions;
-            while (region) {
-                if (fault_address >= region->virtual_address && 
-                    fault_address < region->virtual_address + region->size) {
-                    
-                    // 分配物理页面
-                    uint32_t physical_address = pfm_allocate_frame();
-                    if (physical_address) {
-                        // 清0页面内容
-                        memset((void*)physical_address, 0, PAGE_SIZE);
-                        
-                        // 页对齐虚拟地址
-                        uint32_t aligned_address = fault_address & PAGE_MASK;
-                        
-                        // 映射页面
-                        if (pd_map_page(current->page_directory, aligned_address, physical_address, 
-                                       region->flags) == 0) {
-                            // 如果是内存映射文件，需要加载文件内容
-                            if (region->type == MEMORY_MAPPED_FILE) {
-                                // 实际系统中需要加载文件内容
-                                kernel_printf("Loading file content for memory mapped file\n");
-                            }
-                            
-                            // 刷新TLB
-                            asm volatile ("invlpg (%0)" : : "r"(fault_address));
-                            return; // 成功处理，返回继续执行
-                        }
-                    }
-                    break;
-                }
-                region = region->next;
-            }
+    }
+    
+    if ((error_code & PF_USER) && (!process_manager || !process_manager->current_process)) {
+        kernel_printf("User page fault but no current process\n");
+        for (;;);
+    }
+    
+    // 用户空间的页面不存在：可能是按需分页，同样不区分特权级
+    if (!(error_code & PF_PROTECTION) && fault_address < USER_SPACE_END &&
+        process_manager && process_manager->current_process) {
+        if (handle_demand_fault(process_manager->current_process, fault_address, error_code) == 0) {
+            return;
         }
     }
     
@@ -404,19 +1259,19 @@ void page_fault_handler(uint32_t error_code) {
     kernel_printf("Unhandled page fault at address 0x%x\n", fault_address);
     
     // 检查错误类型
-    if (error_code & 0x1) {
-        kernel_printf("Page not present\n");
-    } else {
+    if (error_code & PF_PROTECTION) {
         kernel_printf("Protection violation\n");
+    } else {
+        kernel_printf("Page not present\n");
     }
     
-    if (error_code & 0x2) {
+    if (error_code & PF_WRITE) {
         kernel_printf("Write operation\n");
     } else {
         kernel_printf("Read operation\n");
     }
     
-    if (error_code & 0x4) {
+    if (error_code & PF_USER) {
         kernel_printf("User mode\n");
         // 终止当前进程
         if (process_manager && process_manager->current_process) {
@@ -434,31 +1289,63 @@ void page_fault_handler(uint32_t error_code) {
 // 声明全局物理内存大小变量，由kernel.c初始化
 extern uint32_t memupper_global;
 
-// 初始化虚拟内存管理器
-void on_init_virtual_memory_manager(VirtualMemoryManager* manager, uint32_t kernel_start, uint32_t kernel_end) {
-    // 保存全局虚拟内存管理器指针
-    vmm = manager;
-    
-    // 初始化页面框管理器
+// 初始化页面框管理器：内核映像、堆、引导模块和引导信息所在的页面框不进入空闲链表。
+// 分页启用前物理地址与虚拟地址相同，kmalloc_pages从此可以直接取页面框
+void on_init_frame_manager(VirtualMemoryManager* manager, MultibootInfo* info, uint32_t heap_start, uint32_t heap_end) {
     PageFrameManager* frame_manager = (PageFrameManager*)malloc(sizeof(PageFrameManager));
     if (!frame_manager) {
         kernel_printf("Failed to allocate memory for page frame manager\n");
         return;
     }
-
     
+    PhysicalRange reserved[PFM_MAX_RESERVED];
+    uint32_t count = 0;
+    
+    reserved[count].start = (uint32_t)kernel_image_start;
+    reserved[count++].end = (uint32_t)kernel_image_end;
+    reserved[count].start = heap_start;
+    reserved[count++].end = heap_end;
+    reserved[count].start = (uint32_t)info;
+    reserved[count++].end = (uint32_t)info + sizeof(MultibootInfo);
+    if (info->flags & MULTIBOOT_INFO_MEM_MAP) {
+        reserved[count].start = info->mmap_addr;
+        reserved[count++].end = info->mmap_addr + info->mmap_length;
+    }
+    if (info->flags & MULTIBOOT_INFO_MODS) {
+        MultibootModule* modules = (MultibootModule*)info->mods_addr;
+        reserved[count].start = info->mods_addr;
+        reserved[count++].end = info->mods_addr + info->mods_count * sizeof(MultibootModule);
+        for (uint32_t i = 0; i < info->mods_count; i++) {
+            if (count == PFM_MAX_RESERVED) {
+                kernel_printf("Too many boot modules, module %d and later are not reserved\n", i);
+                break;
+            }
+            reserved[count].start = modules[i].mod_start;
+            reserved[count++].end = modules[i].mod_end;
+        }
+    }
     
-    // 计算可用物理内存大小
-    uint32_t total_memory = memupper_global * 1024;
+    // 页面框表由堆分配，位于已保留的堆区间内
+    pfm_init_from_multiboot(frame_manager, info, reserved, count);
     
-    // 初始化页面框管理器，从16MB开始（避开内核占用的内存）
-    uint32_t frame_manager_start = 16 * 1024 * 1024;
-    uint32_t frame_manager_size = total_memory - frame_manager_start;
+    manager->frame_manager = frame_manager;
+    manager->kernel_directory = NULL;
+    manager->heap_end = heap_end;
+    manager->identity_end = 0;
+    vmm = manager;
+}
 
+// 初始化虚拟内存管理器，需先调用on_init_frame_manager
+void on_init_virtual_memory_manager(VirtualMemoryManager* manager, uint32_t kernel_start, uint32_t kernel_end) {
+    // 保存全局虚拟内存管理器指针
+    vmm = manager;
     
-    pfm_init(frame_manager, frame_manager_start, frame_manager_size);
+    PageFrameManager* frame_manager = manager->frame_manager;
+    if (!frame_manager) {
+        kernel_printf("Page Frame Manager not initialized\n");
+        return;
+    }
     
-    manager->frame_manager = frame_manager;
     manager->kernel_start = kernel_start;
     manager->kernel_end = kernel_end;
     
@@ -478,21 +1365,51 @@ void on_init_virtual_memory_manager(VirtualMemoryManager* manager, uint32_t kern
     kernel_printf("Kernel size: %d KB\n", (kernel_end - kernel_start) / 1024);
     kernel_printf("Page directory address: 0x%x\n", manager->kernel_directory);
     kernel_printf("Total physical memory: %d KB\n", memupper_global);
-    kernel_printf("Page frame manager start address: 0x%x\n", frame_manager_start);
-    kernel_printf("Page frame manager size: %d KB\n", frame_manager_size / 1024);
+    kernel_printf("Page frames managed: %d (from 0x%x)\n", frame_manager->total_frames,
+                 frame_manager->base_frame * PAGE_SIZE);
     kernel_printf("Available page frames: %d\n", frame_manager->free_frames);
     
     
-    // Map kernel space
+    // 把内核映像、内核堆和全部受管理的物理内存恒等映射。内核直接用物理地址访问页表和页面框，
+    // 因此整段都要映射；支持PSE时每4MB只用一个页目录项，并标记为全局页，切换地址空间时不被刷新。
+    // 恒等映射必须留在用户空间下限以下，否则会挡住用户栈和mmap区域
+    uint32_t identity_end = (frame_manager->base_frame + frame_manager->total_frames) * PAGE_SIZE;
+    if (kernel_end > identity_end) {
+        identity_end = kernel_end;
+    }
+    if (manager->heap_end > identity_end) {
+        identity_end = manager->heap_end;
+    }
+    identity_end = (identity_end + LARGE_PAGE_SIZE - 1) & LARGE_PAGE_MASK;
+    if (identity_end > USER_SPACE_START) {
+        kernel_printf("Kernel memory (up to 0x%x) overlaps user space at 0x%x\n", identity_end, USER_SPACE_START);
+        return;
+    }
+    
+    uint32_t features = cpuid_features();
+    uint32_t kernel_flags = PTE_PRESENT | PTE_WRITABLE;
+    if (features & CPUID_FEATURE_PGE) {
+        kernel_flags |= PTE_GLOBAL;
+    }
+    
     kernel_printf("Starting to map kernel space...\n");
     uint32_t mapped_pages = 0;
-    for (uint32_t virt = kernel_start; virt < kernel_end; virt += PAGE_SIZE) {
-        // Identity mapping for kernel space
-        uint32_t phys = virt;
-        if (pd_map_page(manager->kernel_directory, virt, phys, PTE_PRESENT | PTE_WRITABLE) == 0) {
-            mapped_pages++;
+    if (features & CPUID_FEATURE_PSE) {
+        set_cr4(get_cr4() | CR4_PSE);
+        for (uint32_t address = 0; address < identity_end; address += LARGE_PAGE_SIZE) {
+            if (pd_map_large_page(manager->kernel_directory, address, address, kernel_flags) == 0) {
+                mapped_pages += LARGE_PAGE_SIZE / PAGE_SIZE;
+            }
+        }
+    } else {
+        // 物理地址0不能作为映射目标，第一页保持不映射，同时可以捕获空指针访问
+        for (uint32_t address = PAGE_SIZE; address < identity_end; address += PAGE_SIZE) {
+            if (pd_map_page(manager->kernel_directory, address, address, kernel_flags) == 0) {
+                mapped_pages++;
+            }
         }
     }
+    manager->identity_end = identity_end;
     kernel_printf("Kernel space mapping completed, mapped pages: %d\n", mapped_pages);
     
     
@@ -501,13 +1418,16 @@ void on_init_virtual_memory_manager(VirtualMemoryManager* manager, uint32_t kern
     pd_switch(manager->kernel_directory);
     kernel_printf("Current page directory address: 0x%x\n", get_cr3());
     
-    while(1);
-
     // Enable paging
     kernel_printf("Enabling paging mechanism...\n");
     enable_paging();
     kernel_printf("Paging status: Enabled (CR0: 0x%x)\n", get_cr0());
     
+    // 全局页在分页启用后再打开
+    if (features & CPUID_FEATURE_PGE) {
+        set_cr4(get_cr4() | CR4_PGE);
+    }
+    
     kernel_printf("Virtual Memory Manager initialized successfully\n");
 }
 
@@ -517,75 +1437,18 @@ int vmm_allocate_pages(PageDirectory* directory, uint32_t virtual_address, uint3
         return -1;
     }
     
-    // 确保虚拟地址和大小是页对齐的
-    virtual_address = virtual_address & PAGE_MASK;
-    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
-    
-    // 分配页面
-    for (uint32_t i = 0; i < size; i += PAGE_SIZE) {
-        uint32_t phys = pfm_allocate_frame();
-        if (!phys) {
-            // 分配失败，释放已分配的页面
-            for (uint32_t j = 0; j < i; j += PAGE_SIZE) {
-                pd_unmap_page(directory, virtual_address + j);
-            }
-            return -1;
-        }
-        
-        if (pd_map_page(directory, virtual_address + i, phys, flags) != 0) {
-            // 映射失败，释放已分配的页面
-            pfm_free_frame(phys);
-            for (uint32_t j = 0; j < i; j += PAGE_SIZE) {
-                pd_unmap_page(directory, virtual_address + j);
-            }
-            return -1;
-        }
-    }
-    
-    return 0;
+    // 逐页分配页面框，按范围映射
+    return pd_map_pages(directory, virtual_address, 0, size, flags, 1);
 }
 
 // 释放虚拟内存页面
 int vmm_free_pages(PageDirectory* directory, uint32_t virtual_address, uint32_t size) {
-    if (!directory) {
-        return -1;
-    }
-    
-    // 确保虚拟地址和大小是页对齐的
-    virtual_address = virtual_address & PAGE_MASK;
-    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
-    
-    // 释放页面
-    for (uint32_t i = 0; i < size; i += PAGE_SIZE) {
-        pd_unmap_page(directory, virtual_address + i);
-    }
-    
-    return 0;
+    return pd_unmap_range(directory, virtual_address, size);
 }
 
 // 映射物理内存到虚拟地址
 int vmm_map_pages(PageDirectory* directory, uint32_t virtual_address, uint32_t physical_address, uint32_t size, uint32_t flags) {
-    if (!directory || !physical_address) {
-        return -1;
-    }
-    
-    // 确保地址和大小是页对齐的
-    virtual_address = virtual_address & PAGE_MASK;
-    physical_address = physical_address & PAGE_MASK;
-    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
-    
-    // 映射页面
-    for (uint32_t i = 0; i < size; i += PAGE_SIZE) {
-        if (pd_map_page(directory, virtual_address + i, physical_address + i, flags) != 0) {
-            // 映射失败，释放已映射的页面
-            for (uint32_t j = 0; j < i; j += PAGE_SIZE) {
-                pd_unmap_page(directory, virtual_address + j);
-            }
-            return -1;
-        }
-    }
-    
-    return 0;
+    return pd_map_range(directory, virtual_address, physical_address, size, flags);
 }
 
 // 解除物理内存映射
@@ -596,7 +1459,11 @@ int vmm_unmap_pages(PageDirectory* directory, uint32_t virtual_address, uint32_t
 
 // 创建内存区域
 MemoryRegion* vmm_create_memory_region(uint32_t virtual_address, uint32_t size, uint32_t flags, MemoryRegionType type) {
-    MemoryRegion* region = (MemoryRegion*)malloc(sizeof(MemoryRegion));
+    if (!memory_region_cache) {
+        memory_region_cache = kmem_cache_create("memory_region", sizeof(MemoryRegion), 0, NULL);
+    }
+    
+    MemoryRegion* region = (MemoryRegion*)kmem_cache_alloc(memory_region_cache);
     if (!region) {
         return NULL;
     }
@@ -606,7 +1473,11 @@ MemoryRegion* vmm_create_memory_region(uint32_t virtual_address, uint32_t size,
     region->size = size;
     region->flags = flags;
     region->type = type;
-    region->next = NULL;
+    region->file = NULL;
+    region->file_offset = 0;
+    region->shared = 0;
+    region->node.key = virtual_address;
+    region->node.data = region;
     
     return region;
 }
@@ -614,50 +1485,284 @@ MemoryRegion* vmm_create_memory_region(uint32_t virtual_address, uint32_t size,
 // 销毁内存区域
 void vmm_destroy_memory_region(MemoryRegion* region) {
     if (region) {
-        free(region);
+        if (region->file) {
+            page_cache_put_file(region->file);
+        }
+        kmem_cache_free(memory_region_cache, region);
     }
 }
 
-// 文件定位模式常量
-#define SEEK_SET 0
-#define SEEK_CUR 1
-#define SEEK_END 2
+// 两个区域首尾相接且属性相同（文件区域还要求文件偏移连续）时可以合并
+static int vmm_regions_mergeable(MemoryRegion* low, MemoryRegion* high) {
+    return low->virtual_address + low->size == high->virtual_address &&
+           low->flags == high->flags && low->type == high->type &&
+           low->file == high->file && low->shared == high->shared &&
+           (!low->file || low->file_offset + low->size == high->file_offset);
+}
 
-// 模拟文件定位函数（当前VFS不支持）
-static int vfs_lseek(int fd, int offset, int whence) {
-    // 简化实现，实际系统中应该根据文件系统具体实现
-    kernel_printf("vfs_lseek called with fd=%d, offset=%d, whence=%d\n", fd, offset, whence);
-    return 0; // 总是返回0，不执行实际操作
+// 与前后相邻的区域合并，返回合并后的区域
+static MemoryRegion* vmm_merge_region(RBTree* regions, MemoryRegion* region) {
+    RBTNode* node = rbtree_prev(regions, &region->node);
+    if (node && vmm_regions_mergeable((MemoryRegion*)node->data, region)) {
+        MemoryRegion* prev = (MemoryRegion*)node->data;
+        prev->size += region->size;
+        rbtree_delete(regions, &region->node);
+        vmm_destroy_memory_region(region);
+        region = prev;
+    }
+    
+    node = rbtree_next(regions, &region->node);
+    if (node && vmm_regions_mergeable(region, (MemoryRegion*)node->data)) {
+        MemoryRegion* next = (MemoryRegion*)node->data;
+        region->size += next->size;
+        rbtree_delete(regions, &next->node);
+        vmm_destroy_memory_region(next);
+    }
+    return region;
 }
 
-// 内存映射文件
-int vmm_map_file(PageDirectory* directory, const char* filename, uint32_t virtual_address, uint32_t flags) {
-    // 这里实现简化版，实际系统中应该打开文件并按需加载页面
-    kernel_printf("Memory mapping file: %s\n", filename);
-    
-    // 打开文件获取大小
-    int fd = vfs_open(filename, O_RDONLY);
-    if (fd < 0) {
-        kernel_printf("Failed to open file: %s\n", filename);
+// 在address处把跨越它的区域拆成两个，address已是区域边界或不在任何区域内时什么也不做
+static int vmm_split_region(RBTree* regions, uint32_t address) {
+    MemoryRegion* region = vmm_find_region(regions, address);
+    if (!region || region->virtual_address == address) {
+        return 0;
+    }
+    
+    uint32_t offset = address - region->virtual_address;
+    MemoryRegion* tail = vmm_create_memory_region(address, region->size - offset, region->flags, region->type);
+    if (!tail) {
+        return -1;
+    }
+    tail->physical_address = region->physical_address;
+    tail->file_offset = region->file_offset + offset;
+    tail->shared = region->shared;
+    tail->file = region->file;
+    if (tail->file) {
+        page_cache_hold_file(tail->file);
+    }
+    
+    region->size = offset;
+    rbtree_insert(regions, &tail->node);
+    return 0;
+}
+
+// 第一个结束地址大于address的区域
+static RBTNode* vmm_region_lower_bound(RBTree* regions, uint32_t address) {
+    RBTNode* node = rbtree_floor(regions, address);
+    if (!node) {
+        return rbtree_first(regions);
+    }
+    MemoryRegion* region = (MemoryRegion*)node->data;
+    if (address - region->virtual_address < region->size) {
+        return node;
+    }
+    return rbtree_next(regions, node);
+}
+
+int vmm_insert_region(RBTree* regions, MemoryRegion* region) {
+    if (!region || region->size == 0) {
+        return -1;
+    }
+    
+    // 用户区域只能位于用户空间窗口内，其下的恒等映射页目录项为所有地址空间共享
+    if (region->virtual_address < USER_SPACE_START || region->virtual_address > USER_SPACE_END ||
+        region->size > USER_SPACE_END - region->virtual_address) {
+        return -1;
+    }
+    
+    // 起始地址不大于新区域末页的最后一个区域若延伸到新区域内，就是重叠
+    RBTNode* node = rbtree_floor(regions, region->virtual_address + region->size - 1);
+    if (node) {
+        MemoryRegion* other = (MemoryRegion*)node->data;
+        if (other->virtual_address + other->size > region->virtual_address) {
+            return -1;
+        }
+    }
+    
+    rbtree_insert(regions, &region->node);
+    vmm_merge_region(regions, region);
+    return 0;
+}
+
+MemoryRegion* vmm_find_region(RBTree* regions, uint32_t address) {
+    RBTNode* node = rbtree_floor(regions, address);
+    if (!node) {
+        return NULL;
+    }
+    MemoryRegion* region = (MemoryRegion*)node->data;
+    return (address - region->virtual_address < region->size) ? region : NULL;
+}
+
+MemoryRegion* vmm_first_region(RBTree* regions) {
+    RBTNode* node = rbtree_first(regions);
+    return node ? (MemoryRegion*)node->data : NULL;
+}
+
+MemoryRegion* vmm_next_region(RBTree* regions, MemoryRegion* region) {
+    RBTNode* node = rbtree_next(regions, &region->node);
+    return node ? (MemoryRegion*)node->data : NULL;
+}
+
+void vmm_destroy_regions(RBTree* regions) {
+    RBTNode* node;
+    while ((node = rbtree_first(regions)) != NULL) {
+        rbtree_delete(regions, node);
+        vmm_destroy_memory_region((MemoryRegion*)node->data);
+    }
+    free(regions->nil);
+    regions->nil = NULL;
+    regions->root = NULL;
+}
+
+void vmm_destroy_address_space(PageDirectory* directory, RBTree* regions) {
+    // 正在使用的地址空间先切换到内核页目录，内核部分在所有页目录中相同
+    if (get_cr3() == (uint32_t)directory && vmm && vmm->kernel_directory) {
+        pd_switch(vmm->kernel_directory);
+    }
+    
+    // 文件区域先解除映射，共享映射的脏页在页缓存释放前写回
+    for (MemoryRegion* region = vmm_first_region(regions); region; region = vmm_next_region(regions, region)) {
+        if (region->file) {
+            vmm_unmap_file(directory, region, region->virtual_address, region->size);
+        }
+    }
+    vmm_destroy_regions(regions);
+    
+    pd_destroy(directory);
+}
+
+int vmm_unmap_regions(PageDirectory* directory, RBTree* regions, uint32_t virtual_address, uint32_t size) {
+    if (!directory || (virtual_address & OFFSET_MASK) || size == 0) {
+        return -1;
+    }
+    
+    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+    uint32_t end = virtual_address + size;
+    if (vmm_split_region(regions, virtual_address) != 0 || vmm_split_region(regions, end) != 0) {
+        return -1;
+    }
+    
+    // 拆分后范围内的区域都完整落在范围内；删除节点不会移动其他节点，后继可以提前取得
+    RBTNode* node = vmm_region_lower_bound(regions, virtual_address);
+    while (node && node->key < end) {
+        RBTNode* next = rbtree_next(regions, node);
+        MemoryRegion* region = (MemoryRegion*)node->data;
+        if (region->file) {
+            vmm_unmap_file(directory, region, region->virtual_address, region->size);
+        } else {
+            vmm_free_pages(directory, region->virtual_address, region->size);
+        }
+        rbtree_delete(regions, node);
+        vmm_destroy_memory_region(region);
+        node = next;
+    }
+    return 0;
+}
+
+int vmm_protect_regions(PageDirectory* directory, RBTree* regions, uint32_t virtual_address, uint32_t size,
+                        uint32_t flags) {
+    if (!directory || (virtual_address & OFFSET_MASK) || size == 0) {
+        return -1;
+    }
+    
+    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+    uint32_t end = virtual_address + size;
+    
+    // 范围必须被区域连续覆盖
+    uint32_t covered = virtual_address;
+    for (RBTNode* node = vmm_region_lower_bound(regions, virtual_address); node && covered < end;
+         node = rbtree_next(regions, node)) {
+        MemoryRegion* region = (MemoryRegion*)node->data;
+        if (region->virtual_address > covered) {
+            break;
+        }
+        covered = region->virtual_address + region->size;
+    }
+    if (covered < end) {
+        return -1;
+    }
+    
+    if (vmm_split_region(regions, virtual_address) != 0 || vmm_split_region(regions, end) != 0) {
         return -1;
     }
     
-    // 模拟获取文件大小（因为当前VFS不支持lseek）
-    uint32_t file_size = 4096; // 假设文件大小为1页
+    // 写时复制的页面保持只读，由写时复制处理在区域可写时恢复
+    for (RBTNode* node = vmm_region_lower_bound(regions, virtual_address); node && node->key < end;
+         node = rbtree_next(regions, node)) {
+        MemoryRegion* region = (MemoryRegion*)node->data;
+        region->flags = flags;
+        uint32_t irq = local_irq_save();
+        for (uint32_t offset = 0; offset < region->size; offset += PAGE_SIZE) {
+            PageTableEntry* entry = pd_get_entry(directory, region->virtual_address + offset);
+            if (entry && entry->present) {
+                entry->read_write = (flags & PTE_WRITABLE) && !(entry->available & PTE_AVAIL_COW);
+            }
+        }
+        local_irq_restore(irq);
+    }
+    if (get_cr3() == (uint32_t)directory) {
+        set_cr3((uint32_t)directory);
+    }
+    
+    RBTNode* node = vmm_region_lower_bound(regions, virtual_address);
+    while (node && node->key < end) {
+        MemoryRegion* region = vmm_merge_region(regions, (MemoryRegion*)node->data);
+        node = rbtree_next(regions, &region->node);
+    }
+    return 0;
+}
+
+// 内存映射文件
+MemoryRegion* vmm_map_file(Inode* inode, uint32_t virtual_address, uint32_t size, uint32_t file_offset,
+                           uint32_t flags, int shared) {
+    if ((virtual_address & OFFSET_MASK) || (file_offset & OFFSET_MASK) || size == 0) {
+        return NULL;
+    }
+    
+    PageCacheFile* file = page_cache_get_file(inode);
+    if (!file) {
+        kernel_printf("File cannot be memory mapped\n");
+        return NULL;
+    }
     
-    // 关闭文件
-    vfs_close(fd);
+    MemoryRegion* region = vmm_create_memory_region(virtual_address, (size + PAGE_SIZE - 1) & PAGE_MASK,
+                                                    flags, MEMORY_MAPPED_FILE);
+    if (!region) {
+        page_cache_put_file(file);
+        return NULL;
+    }
+    region->file = file;
+    region->file_offset = file_offset;
+    region->shared = shared ? 1 : 0;
     
-    // 分配足够的页面
-    uint32_t size = (file_size + PAGE_SIZE - 1) & PAGE_MASK;
-    return vmm_allocate_pages(directory, virtual_address, size, flags);
+    return region;
 }
 
 // 解除内存映射文件
-int vmm_unmap_file(PageDirectory* directory, uint32_t virtual_address) {
-    // 这里实现简化版，实际系统中应该释放相关资源
-    kernel_printf("Unmapping file at address 0x%x\n", virtual_address);
+int vmm_unmap_file(PageDirectory* directory, MemoryRegion* region, uint32_t virtual_address, uint32_t size) {
+    if (!directory || !region || !region->file) {
+        return -1;
+    }
+    
+    virtual_address = virtual_address & PAGE_MASK;
+    size = (size + PAGE_SIZE - 1) & PAGE_MASK;
+    
+    // 硬件在页表项中记录的脏位说明共享页面被写过
+    int dirty = 0;
+    uint32_t irq = local_irq_save();
+    for (uint32_t i = 0; region->shared && i < size; i += PAGE_SIZE) {
+        PageTableEntry* entry = pd_get_entry(directory, virtual_address + i);
+        if (entry && entry->present && entry->dirty) {
+            page_cache_mark_dirty(region->file,
+                                  (region->file_offset + virtual_address + i - region->virtual_address) / PAGE_SIZE);
+            dirty = 1;
+        }
+    }
+    local_irq_restore(irq);
+    pd_unmap_range(directory, virtual_address, size);
     
-    // 假设每个文件映射至少一个页面
-    return vmm_free_pages(directory, virtual_address, PAGE_SIZE);
-}
\ No newline at end of file
+    if (dirty) {
+        page_cache_sync(region->file);
+    }
+    return 0;
+}
@@ -0,0 +1,261 @@
+#include <kernel/memory/slab.h>
+#include <kernel/memory/malloc.h>
+#include <kernel/memory/paging.h>
+#include <kernel/kerio.h>
+#include <kernel/string.h>
+#include <kernel/sync.h>
+
+// 所有缓存组成的链表，用于状态打印
+static KmemCache* cache_chain = NULL;
+static uint32_t cache_chain_lock = 0;
+
+static void slab_list_remove(KmemSlab** list, KmemSlab* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static void slab_list_push(KmemSlab** list, KmemSlab* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+// 空闲对象中存放链接指针的位置
+static inline void** slab_free_link(KmemCache* cache, void* object) {
+    return (void**)((uint8_t*)object + cache->free_offset);
+}
+
+// 分配一个页对齐的slab页
+static KmemSlab* slab_page_alloc() {
+    return (KmemSlab*)kmalloc_pages(1);
+}
+
+static void slab_page_free(KmemSlab* slab) {
+    kfree_pages(slab, 1);
+}
+
+// 为缓存新建一个slab：按着色偏移排布对象，构造后串入空闲链
+static KmemSlab* cache_grow(KmemCache* cache) {
+    KmemSlab* slab = slab_page_alloc();
+    if (!slab) {
+        return NULL;
+    }
+
+    slab->cache = cache;
+    slab->in_use = 0;
+    slab->next = NULL;
+    slab->prev = NULL;
+
+    // 相邻slab的对象错开不同的缓存行，避免总落在同一组缓存上
+    size_t colour = cache->colour_next * KMEM_COLOUR_ALIGN;
+    cache->colour_next = (cache->colour_next + 1) % cache->colour_count;
+
+    uint8_t* object = (uint8_t*)slab + cache->first_offset + colour;
+    slab->free_objects = NULL;
+    for (uint32_t i = 0; i < cache->objects_per_slab; i++) {
+        if (cache->ctor) {
+            cache->ctor(object);
+        }
+        *slab_free_link(cache, object) = slab->free_objects;
+        slab->free_objects = object;
+        object += cache->object_size;
+    }
+
+    cache->slab_count++;
+    return slab;
+}
+
+// 创建对象缓存
+KmemCache* kmem_cache_create(const char* name, size_t size, size_t align, kmem_ctor ctor) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (align < KMEM_MIN_ALIGN) {
+        align = KMEM_MIN_ALIGN;
+    }
+
+    KmemCache* cache = (KmemCache*)malloc(sizeof(KmemCache));
+    if (!cache) {
+        kernel_printf("kmem_cache_create: no memory for cache %s\n", name);
+        return NULL;
+    }
+    memset(cache, 0, sizeof(KmemCache));
+
+    strncpy(cache->name, name ? name : "unnamed", KMEM_CACHE_NAME_LEN - 1);
+    cache->align = align;
+    cache->object_size = (size + align - 1) & ~(align - 1);
+    // 构造后的状态要跨越分配和释放保持，链接指针不能占用对象本身
+    if (ctor) {
+        cache->free_offset = cache->object_size;
+        cache->object_size = (cache->free_offset + sizeof(void*) + align - 1) & ~(align - 1);
+    }
+    cache->first_offset = (sizeof(KmemSlab) + align - 1) & ~(align - 1);
+    cache->ctor = ctor;
+
+    if (cache->first_offset + cache->object_size > PAGE_SIZE) {
+        kernel_printf("kmem_cache_create: object size %d too large for cache %s\n", size, cache->name);
+        free(cache);
+        return NULL;
+    }
+
+    size_t usable = PAGE_SIZE - cache->first_offset;
+    cache->objects_per_slab = usable / cache->object_size;
+
+    // 剩余的空间用于着色，着色步长需保持对象对齐
+    size_t leftover = usable - cache->objects_per_slab * cache->object_size;
+    cache->colour_count = (align <= KMEM_COLOUR_ALIGN) ? leftover / KMEM_COLOUR_ALIGN + 1 : 1;
+    cache->colour_next = 0;
+
+    acquire_lock(&cache_chain_lock);
+    cache->next = cache_chain;
+    cache_chain = cache;
+    release_lock(&cache_chain_lock);
+
+    return cache;
+}
+
+// 销毁缓存，要求所有对象都已归还
+void kmem_cache_destroy(KmemCache* cache) {
+    if (!cache) {
+        return;
+    }
+
+    if (cache->active_objects != 0) {
+        kernel_printf("kmem_cache_destroy: cache %s still has %d objects in use\n",
+                     cache->name, cache->active_objects);
+        return;
+    }
+
+    acquire_lock(&cache_chain_lock);
+    KmemCache** link = &cache_chain;
+    while (*link && *link != cache) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = cache->next;
+    }
+    release_lock(&cache_chain_lock);
+
+    while (cache->empty) {
+        KmemSlab* slab = cache->empty;
+        slab_list_remove(&cache->empty, slab);
+        slab_page_free(slab);
+    }
+
+    free(cache);
+}
+
+// 从缓存分配一个对象
+void* kmem_cache_alloc(KmemCache* cache) {
+    if (!cache) {
+        return NULL;
+    }
+
+    uint32_t flags = local_irq_save();
+    acquire_lock(&cache->lock);
+
+    // 优先使用部分使用的slab，其次是空slab，都没有时新建
+    KmemSlab* slab = cache->partial;
+    if (!slab && cache->empty) {
+        slab = cache->empty;
+        slab_list_remove(&cache->empty, slab);
+        cache->empty_count--;
+        slab_list_push(&cache->partial, slab);
+    }
+    if (!slab) {
+        slab = cache_grow(cache);
+        if (!slab) {
+            release_lock(&cache->lock);
+            local_irq_restore(flags);
+            kernel_printf("kmem_cache_alloc: no memory for cache %s\n", cache->name);
+            return NULL;
+        }
+        slab_list_push(&cache->partial, slab);
+    }
+
+    void* object = slab->free_objects;
+    slab->free_objects = *slab_free_link(cache, object);
+    slab->in_use++;
+    cache->active_objects++;
+
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+
+    release_lock(&cache->lock);
+    local_irq_restore(flags);
+    return object;
+}
+
+// 将对象归还缓存
+void kmem_cache_free(KmemCache* cache, void* object) {
+    if (!cache || !object) {
+        return;
+    }
+
+    KmemSlab* slab = (KmemSlab*)((size_t)object & PAGE_MASK);
+    if (slab->cache != cache) {
+        kernel_printf("kmem_cache_free: object %x does not belong to cache %s\n", object, cache->name);
+        return;
+    }
+
+    uint32_t flags = local_irq_save();
+    acquire_lock(&cache->lock);
+
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+
+    *slab_free_link(cache, object) = slab->free_objects;
+    slab->free_objects = object;
+    slab->in_use--;
+    cache->active_objects--;
+
+    // slab完全空闲时移入空链表，超出保留数量则归还其页
+    KmemSlab* release = NULL;
+    if (slab->in_use == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty_count < KMEM_MAX_EMPTY_SLABS) {
+            slab_list_push(&cache->empty, slab);
+            cache->empty_count++;
+        } else {
+            cache->slab_count--;
+            release = slab;
+        }
+    }
+
+    release_lock(&cache->lock);
+
+    if (release) {
+        slab_page_free(release);
+    }
+
+    local_irq_restore(flags);
+}
+
+// 打印所有缓存的使用情况
+void kmem_print_status() {
+    kernel_printf("Slab caches:\n");
+
+    acquire_lock(&cache_chain_lock);
+    for (KmemCache* cache = cache_chain; cache != NULL; cache = cache->next) {
+        kernel_printf("  %s: object size=%d, active=%d, slabs=%d, per slab=%d\n",
+                     cache->name, cache->object_size, cache->active_objects,
+                     cache->slab_count, cache->objects_per_slab);
+    }
+    release_lock(&cache_chain_lock);
+}
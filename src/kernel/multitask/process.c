@@ -1,5 +1,7 @@
 #include <kernel/kerio.h>
 #include <kernel/memory/malloc.h>
+#include <kernel/memory/slab.h>
+#include <kernel/memory/page_cache.h>
 #include <kernel/multitask/process.h>
 #include <kernel/string.h>
 #include <stdbool.h>
@@ -7,6 +9,9 @@
 // 全局进程管理器指针
 ProcessManager* process_manager = NULL;
 
+// 进程控制块的对象缓存
+static KmemCache* process_cache = NULL;
+
 // 工具函数：查找空闲PID
 static uint32_t find_free_pid(ProcessManager* manager) {
     for (uint32_t i = 0; i < PROCESS_MAX_COUNT; i++) {
@@ -140,6 +145,8 @@ void process_manager_init(ProcessManager* manager, struct GDT* gdt) {
     
     process_manager = manager;
     
+    process_cache = kmem_cache_create("process", sizeof(Process), 0, NULL);
+    
     kernel_printf("Process manager initialized successfully\n");
 }
 
@@ -157,7 +164,7 @@ uint32_t create_process(const char* name, int (*entry)(int, char**), int argc, c
     }
     
     // 分配进程控制块
-    Process* process = (Process*)malloc(sizeof(Process));
+    Process* process = (Process*)kmem_cache_alloc(process_cache);
     if (!process) {
         kernel_printf("Failed to allocate memory for process\n");
         return -1;
@@ -178,26 +185,27 @@ uint32_t create_process(const char* name, int (*entry)(int, char**), int argc, c
     process->argc = argc;
     process->argv = argv;
     process->exit_code = 0;
-    process->memory_regions = NULL;
     
     // 创建进程页目录
     process->page_directory = pd_create();
     if (!process->page_directory) {
         kernel_printf("Failed to create page directory\n");
-        free(process);
+        kmem_cache_free(process_cache, process);
         return -1;
     }
     
     // 分配并初始化内核栈
     process->kernel_stack_size = KERNEL_STACK_SIZE;
-    process->kernel_stack = malloc(process->kernel_stack_size);
+    process->kernel_stack = kmalloc_pages(KERNEL_STACK_SIZE / PAGE_SIZE);
     if (!process->kernel_stack) {
         kernel_printf("Failed to allocate kernel stack\n");
         pd_destroy(process->page_directory);
-        free(process);
+        kmem_cache_free(process_cache, process);
         return -1;
     }
     
+    rbtree_init(&process->memory_regions);
+    
     if (privilege == USER_MODE) {
         // 为用户态进程分配用户栈
         process->user_stack_size = USER_STACK_SIZE;
@@ -205,24 +213,19 @@ uint32_t create_process(const char* name, int (*entry)(int, char**), int argc, c
         // 用户栈在虚拟地址空间的底部
         uint32_t user_stack_virtual = USER_STACK_BASE - process->user_stack_size;
         
-        // 分配并映射用户栈
-        if (vmm_allocate_pages(process->page_directory, user_stack_virtual, process->user_stack_size, 
-                              PTE_PRESENT | PTE_WRITABLE | PTE_USER) != 0) {
-            kernel_printf("Failed to allocate user stack\n");
-            pd_destroy(process->page_directory);
-            free(process->kernel_stack);
-            free(process);
-            return -1;
-        }
-        
-        // 记录用户栈内存区域
+        // 只登记用户栈内存区域，页面在第一次访问时由页面故障处理按需分配
         MemoryRegion* stack_region = vmm_create_memory_region(user_stack_virtual, 
                                                            process->user_stack_size, 
                                                            PTE_PRESENT | PTE_WRITABLE | PTE_USER, 
                                                            MEMORY_STACK);
-        if (stack_region) {
-            stack_region->next = process->memory_regions;
-            process->memory_regions = stack_region;
+        if (!stack_region || vmm_insert_region(&process->memory_regions, stack_region) != 0) {
+            kernel_printf("Failed to allocate user stack\n");
+            vmm_destroy_memory_region(stack_region);
+            vmm_destroy_regions(&process->memory_regions);
+            pd_destroy(process->page_directory);
+            kfree_pages(process->kernel_stack, KERNEL_STACK_SIZE / PAGE_SIZE);
+            kmem_cache_free(process_cache, process);
+            return -1;
         }
         
         // 保存用户栈的虚拟地址
@@ -270,6 +273,107 @@ uint32_t create_process(const char* name, int (*entry)(int, char**), int argc, c
     return pid;
 }
 
+// 复制当前进程：子进程写时复制地共享父进程的用户空间，从state描述的现场开始运行。
+// 内核栈上的返回地址等指向父进程自己的栈，因此只支持从用户态陷入的用户进程
+uint32_t fork_process(const struct RegisterState* state) {
+    if (!process_manager || !process_manager->current_process || !state) {
+        return -1;
+    }
+
+    Process* parent = process_manager->current_process;
+    if (parent->privilege != USER_MODE) {
+        kernel_printf("fork: only user mode processes can be forked\n");
+        return -1;
+    }
+
+    uint32_t pid = find_free_pid(process_manager);
+    if (pid == (uint32_t)-1) {
+        kernel_printf("No available PID for new process\n");
+        return -1;
+    }
+
+    Process* process = (Process*)kmem_cache_alloc(process_cache);
+    if (!process) {
+        kernel_printf("Failed to allocate memory for process\n");
+        return -1;
+    }
+
+    // 名称、优先级、用户栈、参数等与父进程相同
+    memcpy(process, parent, sizeof(Process));
+    process->pid = pid;
+    process->parent_pid = parent->pid;
+    process->state = PROCESS_CREATED;
+    process->priority = process->base_priority;
+    process->time_slice = TIME_SLICE_BASE * (MAX_PRIORITY_LEVELS - process->priority);
+    process->total_runtime = 0;
+    process->wakeup_time = 0;
+    process->exit_code = 0;
+    process->next = NULL;
+
+    process->kernel_stack_size = KERNEL_STACK_SIZE;
+    process->kernel_stack = kmalloc_pages(KERNEL_STACK_SIZE / PAGE_SIZE);
+    if (!process->kernel_stack) {
+        kernel_printf("Failed to allocate kernel stack\n");
+        kmem_cache_free(process_cache, process);
+        return -1;
+    }
+
+    // 复制内存区域记录
+    rbtree_init(&process->memory_regions);
+    for (MemoryRegion* region = vmm_first_region(&parent->memory_regions); region;
+         region = vmm_next_region(&parent->memory_regions, region)) {
+        MemoryRegion* copy = vmm_create_memory_region(region->virtual_address, region->size,
+                                                      region->flags, region->type);
+        if (!copy) {
+            kernel_printf("Failed to copy memory regions\n");
+            vmm_destroy_regions(&process->memory_regions);
+            kfree_pages(process->kernel_stack, KERNEL_STACK_SIZE / PAGE_SIZE);
+            kmem_cache_free(process_cache, process);
+            return -1;
+        }
+        copy->physical_address = region->physical_address;
+        copy->file_offset = region->file_offset;
+        copy->shared = region->shared;
+        copy->file = region->file;
+        if (copy->file) {
+            page_cache_hold_file(copy->file);
+        }
+        if (vmm_insert_region(&process->memory_regions, copy) != 0) {
+            // 未插入的副本单独销毁，释放它持有的文件引用
+            kernel_printf("Failed to copy memory regions\n");
+            vmm_destroy_memory_region(copy);
+            vmm_destroy_regions(&process->memory_regions);
+            kfree_pages(process->kernel_stack, KERNEL_STACK_SIZE / PAGE_SIZE);
+            kmem_cache_free(process_cache, process);
+            return -1;
+        }
+    }
+
+    process->page_directory = pd_clone(parent->page_directory);
+    if (!process->page_directory) {
+        kernel_printf("Failed to clone page directory\n");
+        vmm_destroy_regions(&process->memory_regions);
+        kfree_pages(process->kernel_stack, KERNEL_STACK_SIZE / PAGE_SIZE);
+        kmem_cache_free(process_cache, process);
+        return -1;
+    }
+
+    // 子进程从内核栈顶的现场返回用户态
+    process->regs = (struct RegisterState*)((uint8_t*)process->kernel_stack + process->kernel_stack_size - sizeof(struct RegisterState));
+    memcpy(process->regs, state, sizeof(struct RegisterState));
+
+    process_manager->processes[pid] = process;
+    set_pid_in_use(process_manager, pid, true);
+    process_manager->active_processes++;
+
+    process->state = PROCESS_READY;
+    enqueue_process(&process_manager->ready_queues[process->priority], process);
+
+    kernel_printf("Forked process %s (PID: %d) from PID %d\n", process->name, process->pid, parent->pid);
+
+    return pid;
+}
+
 // 终止进程
 void terminate_process(uint32_t pid, int exit_code) {
     if (!process_manager || pid >= PROCESS_MAX_COUNT) {
@@ -281,14 +385,15 @@ void terminate_process(uint32_t pid, int exit_code) {
         return;
     }
     
-    // 设置进程状态为终止
+    // 设置进程状态为终止，原状态决定要从哪个队列中移除
+    ProcessState state = process->state;
     process->state = PROCESS_TERMINATED;
     process->exit_code = exit_code;
     
     // 从当前队列中移除
-    if (process->state == PROCESS_READY) {
+    if (state == PROCESS_READY) {
         remove_process_from_queue(&process_manager->ready_queues[process->priority], pid);
-    } else if (process->state == PROCESS_BLOCKED) {
+    } else if (state == PROCESS_BLOCKED) {
         remove_process_from_queue(&process_manager->blocked_queue, pid);
     } else if (process == process_manager->current_process) {
         process_manager->current_process = NULL;
@@ -408,12 +513,14 @@ uint32_t schedule(uint32_t esp) {
     if (!next_process) {
         
         process_manager->current_process = NULL;
+        malloc_switch_context(MALLOC_KERNEL_CONTEXT);
         return esp;
     }
     
     // 设置为运行状态
     next_process->state = PROCESS_RUNNING;
     process_manager->current_process = next_process;
+    malloc_switch_context(MALLOC_PROCESS_CONTEXT(next_process->pid));
     
     // 切换到新进程的页目录
     if (next_process->page_directory) {
@@ -461,16 +568,17 @@ void process_manager_tick() {
             current = current->next;
             
             // 释放资源
-            if (to_free->user_stack) {
-                free(to_free->user_stack);
-            }
-            free(to_free->kernel_stack);
-            free(to_free);
+            malloc_release_context(MALLOC_PROCESS_CONTEXT(to_free->pid));
+            // 用户栈只是地址空间中的一个内存区域，随地址空间一起释放
+            vmm_destroy_address_space(to_free->page_directory, &to_free->memory_regions);
+            kfree_pages(to_free->kernel_stack, to_free->kernel_stack_size / PAGE_SIZE);
             
-            // 从进程数组中移除
+            // 从进程数组中移除（需在归还进程控制块之前读取pid）
             process_manager->processes[to_free->pid] = NULL;
             set_pid_in_use(process_manager, to_free->pid, false);
             process_manager->active_processes--;
+            
+            kmem_cache_free(process_cache, to_free);
         }
         process_manager->terminated_queue = NULL;
     }
@@ -14,6 +14,9 @@ extern ProcessManager* process_manager;
 // 系统调用表
 static syscall_handler syscall_table[128];
 
+// 正在处理的系统调用的现场，fork据此构造子进程的返回现场
+static SyscallFrame* current_syscall_frame = NULL;
+
 // 进程文件描述符表大小
 #define FD_TABLE_SIZE 64
 #define MAX_FILE_DESCRIPTOR_TABLES 64
@@ -175,11 +178,31 @@ int syscall_handler_ioctl(uint32_t fd, uint32_t request, uint32_t argp, uint32_t
     return file_desc->ops->ioctl(file_desc->inode, request, (void*)argp);
 }
 
-// fork系统调用：创建新进程（简化实现）
+// fork系统调用：创建新进程，父子进程写时复制地共享用户空间，子进程中返回0
 int syscall_handler_fork(uint32_t unused1, uint32_t unused2, uint32_t unused3, uint32_t unused4, uint32_t unused5) {
-    // 简化实现，实际系统中需要复制进程的内存空间和资源
-    kernel_printf("fork system call is not fully implemented yet\n");
-    return -1;
+    SyscallFrame* frame = current_syscall_frame;
+    if (!frame || (frame->cs & 3) == 0) {
+        kernel_printf("fork: must be called from user mode\n");
+        return -1;
+    }
+    
+    // 子进程从系统调用返回处继续运行
+    struct RegisterState state;
+    state.eax = 0;
+    state.ebx = frame->ebx;
+    state.ecx = frame->ecx;
+    state.edx = frame->edx;
+    state.esi = frame->esi;
+    state.edi = frame->edi;
+    state.ebp = frame->ebp;
+    state.error = 0;
+    state.eip = frame->eip;
+    state.cs = frame->cs;
+    state.eflags = frame->eflags;
+    state.esp = frame->user_esp;
+    state.ss = frame->user_ss;
+    
+    return fork_process(&state);
 }
 
 // execve系统调用：执行新程序（简化实现）
@@ -215,12 +238,13 @@ int syscall_handler_yield(uint32_t unused1, uint32_t unused2, uint32_t unused3,
 }
 
 // 系统调用中断处理函数
-extern uint32_t handle_syscall_interrupt(uint32_t eax, uint32_t ebx, uint32_t ecx, uint32_t edx, uint32_t esi, uint32_t edi) {
-    uint32_t syscall_num = eax;
+extern uint32_t handle_syscall_interrupt(SyscallFrame* frame) {
+    uint32_t syscall_num = frame->eax;
     
     // 检查系统调用号是否有效
     if (syscall_num >= sizeof(syscall_table) / sizeof(syscall_handler)) {
         kernel_printf("Invalid system call number: %d\n", syscall_num);
+        frame->eax = -1;
         return -1;
     }
     
@@ -228,17 +252,21 @@ extern uint32_t handle_syscall_interrupt(uint32_t eax, uint32_t ebx, uint32_t ec
     syscall_handler handler = syscall_table[syscall_num];
     if (!handler) {
         kernel_printf("Unimplemented system call: %d\n", syscall_num);
+        frame->eax = -1;
         return -1;
     }
     
     // 调用系统调用处理函数
-    int result = handler(ebx, ecx, edx, esi, edi);
+    current_syscall_frame = frame;
+    int result = handler(frame->ebx, frame->ecx, frame->edx, frame->esi, frame->edi);
+    current_syscall_frame = NULL;
     
-    // 设置当前进程的系统调用结果
+    // 设置当前进程的系统调用结果，并通过eax返回给调用者
     Process* current = process_manager->current_process;
     if (current) {
         current->syscall_result = result;
     }
+    frame->eax = result;
     
     return result;
 }
@@ -263,6 +291,7 @@ extern void syscall_init() {
     syscall_table[SYS_yield] = syscall_handler_yield;
     syscall_table[SYS_mmap] = syscall_handler_mmap;
     syscall_table[SYS_munmap] = syscall_handler_munmap;
+    syscall_table[SYS_mprotect] = syscall_handler_mprotect;
     
     kernel_printf("System call table initialized\n");
 }
@@ -281,6 +310,14 @@ int syscall_handler_mmap(uint32_t addr, uint32_t len, uint32_t prot, uint32_t fl
 
     // 确保长度是页大小的整数倍
     len = (len + PAGE_SIZE - 1) & PAGE_MASK;
+    if ((addr & ~PAGE_MASK) != 0 || addr < USER_SPACE_START || addr + len > USER_SPACE_END || addr + len <= addr) {
+        return -1;
+    }
+
+    // MAP_FIXED替换范围内原有的映射，否则不允许与已有区域重叠
+    if (flags & MAP_FIXED) {
+        syscall_handler_munmap(addr, len, 0, 0, 0);
+    }
 
     // 检查保护标志的有效性
     uint32_t page_flags = PTE_PRESENT;
@@ -290,53 +327,30 @@ int syscall_handler_mmap(uint32_t addr, uint32_t len, uint32_t prot, uint32_t fl
     // 添加用户模式标志
     page_flags |= PTE_USER;
 
-    // 处理文件映射或匿名映射
+    // 处理文件映射或匿名映射。两者都只登记内存区域，页面在第一次访问时才分配
+    MemoryRegion* region;
     if (fd != -1 && !(flags & MAP_ANONYMOUS)) {
-        // 文件映射
+        // 文件映射：页面经页缓存读入，MAP_SHARED的映射共享缓存页并在解除映射时写回
         FileDescriptor* file_desc = get_fd(fd);
         if (!file_desc || !file_desc->inode) {
             return -1;
         }
-
-        // 在实际系统中，需要实现按需加载页面（demand paging）
-        // 这里我们只是简单地分配物理内存并映射
-        int result = vmm_allocate_pages(current->page_directory, addr, len, page_flags);
-        if (result != 0) {
-            return -1;
-        }
-
-        // 创建内存区域记录
-        MemoryRegion* region = vmm_create_memory_region(addr, len, page_flags, MEMORY_MAPPED_FILE);
-        if (!region) {
-            vmm_free_pages(current->page_directory, addr, len);
-            return -1;
-        }
-
-        // 将内存区域添加到进程的内存区域链表
-        region->next = current->memory_regions;
-        current->memory_regions = region;
-
-        return addr;
+        region = vmm_map_file(file_desc->inode, addr, len, 0, page_flags, flags & MAP_SHARED);
     } else {
         // 匿名映射
-        int result = vmm_allocate_pages(current->page_directory, addr, len, page_flags);
-        if (result != 0) {
-            return -1;
-        }
-
-        // 创建内存区域记录
-        MemoryRegion* region = vmm_create_memory_region(addr, len, page_flags, MEMORY_DATA);
-        if (!region) {
-            vmm_free_pages(current->page_directory, addr, len);
-            return -1;
-        }
-
-        // 将内存区域添加到进程的内存区域链表
-        region->next = current->memory_regions;
-        current->memory_regions = region;
+        region = vmm_create_memory_region(addr, len, page_flags, MEMORY_DATA);
+    }
+    if (!region) {
+        return -1;
+    }
 
-        return addr;
+    // 将内存区域添加到进程的区域树，与相邻的同类区域合并
+    if (vmm_insert_region(&current->memory_regions, region) != 0) {
+        vmm_destroy_memory_region(region);
+        return -1;
     }
+
+    return addr;
 }
 
 // munmap系统调用：解除内存映射
@@ -353,19 +367,50 @@ int syscall_handler_munmap(uint32_t addr, uint32_t len, uint32_t unused1, uint32
 
     // 确保长度是页大小的整数倍
     len = (len + PAGE_SIZE - 1) & PAGE_MASK;
+    if (addr + len > USER_SPACE_END || addr + len <= addr) {
+        return -1;
+    }
 
-    // 解除内存映射
+    // 跨越范围边界的区域被拆分，文件区域先写回共享映射的脏页
+    if (vmm_unmap_regions(current->page_directory, &current->memory_regions, addr, len) != 0) {
+        return -1;
+    }
+
+    // 解除范围内未登记为区域的映射
     int result = vmm_free_pages(current->page_directory, addr, len);
     if (result != 0) {
         return -1;
     }
 
-    // 简化实现：从进程的内存区域链表中移除对应的区域
-    // 这里应该查找并移除对应的内存区域，但为简化实现，我们省略具体的内存区域链表操作
-
     return 0;
 }
 
+// mprotect系统调用：修改已映射范围的访问权限
+int syscall_handler_mprotect(uint32_t addr, uint32_t len, uint32_t prot, uint32_t unused1, uint32_t unused2) {
+    Process* current = process_manager->current_process;
+    if (!current) {
+        return -1;
+    }
+
+    // 验证参数有效性
+    if (len == 0 || (addr & ~PAGE_MASK) != 0) {
+        return -1;
+    }
+
+    len = (len + PAGE_SIZE - 1) & PAGE_MASK;
+    if (addr + len > USER_SPACE_END || addr + len <= addr) {
+        return -1;
+    }
+
+    // 与mmap相同，页表只能区分可写与只读
+    uint32_t page_flags = PTE_PRESENT | PTE_USER;
+    if (prot & PROT_WRITE) {
+        page_flags |= PTE_WRITABLE;
+    }
+
+    return vmm_protect_regions(current->page_directory, &current->memory_regions, addr, len, page_flags);
+}
+
 extern uint32_t memory_size;
 size_t syscall_handler_mm_size(){
     return memory_size;
@@ -1,6 +1,8 @@
 #include <user/shell/shell.h>
 #include <kernel/string.h>
 #include <kernel/memory/malloc.h>
+#include <kernel/memory/malloc_profile.h>
+#include <kernel/memory/paging.h>
 #include <driver/keyboard.h>
 #include <stdio.h>
 
@@ -27,6 +29,7 @@ static ShellCommand builtin_commands[] = {
     {"rm", shell_cmd_rm, "删除文件"},
     {"ps", shell_cmd_ps, "显示进程状态"},
     {"memory", shell_cmd_memory, "显示内存信息"},
+    {"heap", shell_cmd_heap, "堆分配剖析: heap [top [n] | checkpoint | leaks <from> [to] | status]"},
     {"test", test_main, "测试命令"},
 };
 
@@ -170,9 +173,18 @@ void shell_tokenize(char* line, int* argc, char*** argv) {
         return;
     }
     
-    // 解析第一个参数
+    // 解析第一个参数，数组不够时原地扩展为两倍
+    int capacity = MAX_ARGS;
     token = strtok(line, " ");
-    while (token && count < MAX_ARGS) {
+    while (token) {
+        if (count == capacity) {
+            char** grown = realloc(args, capacity * 2 * sizeof(char*));
+            if (!grown) {
+                break;
+            }
+            args = grown;
+            capacity *= 2;
+        }
         args[count] = token;
         count++;
         token = strtok(NULL, " ");
@@ -325,5 +337,41 @@ int shell_cmd_ps(int argc, char** argv) {
 
 int shell_cmd_memory(int argc, char** argv) {
     printf("Heap size: %d bytes\n", syscall_handler_mm_size());
+    pfm_print_status();
+    return 0;
+}
+
+// 解析十进制无符号数，非法时返回default_value
+static uint32_t shell_parse_uint(const char* text, uint32_t default_value) {
+    if (!text || !*text) {
+        return default_value;
+    }
+    
+    uint32_t value = 0;
+    for (; *text; text++) {
+        if (*text < '0' || *text > '9') {
+            return default_value;
+        }
+        value = value * 10 + (*text - '0');
+    }
+    return value;
+}
+
+// heap命令：查看分配热点，或用检查点查找泄漏
+int shell_cmd_heap(int argc, char** argv) {
+    if (argc < 2 || strcmp(argv[1], "top") == 0) {
+        malloc_profile_print_top(argc > 2 ? shell_parse_uint(argv[2], 10) : 10);
+    } else if (strcmp(argv[1], "checkpoint") == 0) {
+        malloc_profile_checkpoint();
+    } else if (strcmp(argv[1], "leaks") == 0 && argc > 2) {
+        uint32_t from = shell_parse_uint(argv[2], 0);
+        uint32_t to = argc > 3 ? shell_parse_uint(argv[3], 0xFFFFFFFF) : 0xFFFFFFFF;
+        malloc_profile_print_outstanding(from, to);
+    } else if (strcmp(argv[1], "status") == 0) {
+        print_memory_status();
+    } else {
+        printf("Usage: heap [top [n] | checkpoint | leaks <from> [to] | status]\n");
+        return -1;
+    }
     return 0;
-}
\ No newline at end of file
+}